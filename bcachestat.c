@@ -0,0 +1,14 @@
+// Print buffer cache statistics: its size and hit rate, and
+// the log's dirty blocks, commits and installs.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int
+main(int argc, char *argv[])
+{
+  report_bcache_stats();
+  report_log_stats();
+  exit();
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a set of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -21,26 +21,82 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
+#define NBUCKET 251
+#define BMAX    (PHYSTOP / BCACHEFRAC / (sizeof(struct buf) + bsize))
+
+// Block size of the file system.  Until bsetsize() is called
+// with the size from the super block, blocks are one sector.
+uint bsize = MINBSIZE;
+
+// Buffers are found through a hash table on (dev, blockno),
+// each bucket with its own lock, so that lookups of different
+// blocks do not contend.  A bucket lock protects its chain and
+// the dev, blockno and refcnt of the buffers on it.
+//
+// Separately, all buffers are kept on an LRU list, through
+// prev/next, protected by bcache.lock; brelse() moves a buffer
+// to the front when its last reference goes, holding both
+// bcache.lock and the bucket lock.  A miss takes
+// bcache.evict, so that only one CPU at a time recycles a
+// buffer and a block can never be cached twice.
+// Lock order: bcache.evict, bcache.lock, bucket locks.
+//
+// The NBUF buffers in bcache.buf are always there.  While
+// plenty of memory is free, a miss adds a buffer from a slab
+// cache instead of recycling one, up to BMAX buffers in all;
+// bshrink() gives unused added buffers back when memory runs
+// short.  Added buffers are only used once the block size is
+// known.
 struct {
   struct spinlock lock;
+  struct spinlock evict;
   struct buf buf[NBUF];
+  uchar data[NBUF][MAXBSIZE];
+  int sized;                 // bsetsize() has been called
+  struct kmem_cache *cache;  // added buffers
+  struct kmem_cache *datacache; // their data, for blocks smaller than a page
+  int nbuf;                  // buffers, static and added
+  uint ngrow;
+  uint nshrink;
 
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+
+  struct {
+    struct spinlock lock;
+    struct buf *head;   // chain through hnext
+    uint nhit;
+    uint nmiss;
+    uint nahead;        // blocks read ahead
+  } bucket[NBUCKET];
 } bcache;
 
+static uint
+bhash(uint dev, uint blockno)
+{
+  return (dev * 31 + blockno) % NBUCKET;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.evict, "bcache.evict");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf));
+  bcache.nbuf = NBUF;
 
 //PAGEBREAK!
   // Create linked list of buffers
@@ -49,47 +105,238 @@ binit(void)
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
     b->next = bcache.head.next;
     b->prev = &bcache.head;
+    b->data = bcache.data[b - bcache.buf];
     initsleeplock(&b->lock, "buffer");
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
 }
 
+// Find dev/blockno on its chain.  Caller holds the bucket lock.
+static struct buf*
+bfind(int h, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bcache.bucket[h].head; b; b = b->hnext)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For read-ahead (ahead set), return 0 instead if the block is
+// cached or no buffer is free.
+static struct buf* bgrow(void);
+static struct buf* brecycle(int);
+
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
   struct buf *b;
+  int h;
 
-  acquire(&bcache.lock);
+  h = bhash(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  acquire(&bcache.bucket[h].lock);
+  if((b = bfind(h, dev, blockno)) != 0){
+    if(ahead){
+      release(&bcache.bucket[h].lock);
+      return 0;
     }
+    b->refcnt++;
+    bcache.bucket[h].nhit++;
+    release(&bcache.bucket[h].lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bcache.bucket[h].lock);
+
+  // Not cached.  Look again once misses are serialized, in
+  // case another CPU has just read the block in.
+  acquire(&bcache.evict);
+  acquire(&bcache.bucket[h].lock);
+  if((b = bfind(h, dev, blockno)) != 0){
+    if(ahead){
+      release(&bcache.bucket[h].lock);
+      release(&bcache.evict);
+      return 0;
+    }
+    b->refcnt++;
+    bcache.bucket[h].nhit++;
+    release(&bcache.bucket[h].lock);
+    release(&bcache.evict);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  if(ahead)
+    bcache.bucket[h].nahead++;
+  else
+    bcache.bucket[h].nmiss++;
+  release(&bcache.bucket[h].lock);
+
+  if((b = bgrow()) == 0 && (b = brecycle(ahead)) == 0){
+    if(!ahead)
+      panic("bget: no buffers");
+    release(&bcache.evict);
+    return 0;
+  }
+
+  acquire(&bcache.bucket[h].lock);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = B_HASHED;
+  b->hnext = bcache.bucket[h].head;
+  bcache.bucket[h].head = b;
+  release(&bcache.bucket[h].lock);
+  release(&bcache.evict);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Add a buffer to the cache if it is below its limit and
+// memory is plentiful.  Returns it with one reference, not yet
+// hashed, or 0.  Caller holds bcache.evict.
+static struct buf*
+bgrow(void)
+{
+  struct buf *b;
+
+  if(!bcache.sized || bcache.nbuf >= BMAX || kfreepages() <= BCACHEFREE ||
+     (b = kmem_cache_alloc(bcache.cache)) == 0)
+    return 0;
+  if(bcache.datacache)
+    b->data = kmem_cache_alloc(bcache.datacache);
+  else
+    b->data = (uchar*)kalloc();
+  if(b->data == 0){
+    kmem_cache_free(bcache.cache, b);
+    return 0;
+  }
+  initsleeplock(&b->lock, "buffer");
+  b->refcnt = 1;
+  b->flags = 0;
+  acquire(&bcache.lock);
+  b->next = bcache.head.next;
+  b->prev = &bcache.head;
+  bcache.head.next->prev = b;
+  bcache.head.next = b;
+  bcache.nbuf++;
+  bcache.ngrow++;
+  release(&bcache.lock);
+  return b;
+}
+
+// Take b off its hash chain.  Caller holds its bucket lock.
+static void
+bunhash(struct buf *b, int v)
+{
+  struct buf **pp;
+
+  if(b->flags & B_HASHED){
+    for(pp = &bcache.bucket[v].head; *pp != b; pp = &(*pp)->hnext)
+      ;
+    *pp = b->hnext;
+  }
+}
+
+// Is b one of the NBUF buffers that are always there?
+static int
+bfixed(struct buf *b)
+{
+  return b >= bcache.buf && b < bcache.buf+NBUF;
+}
+
+// Recycle the least recently used unused buffer and return
+// it with one reference, no longer hashed, or 0 if all are
+// busy.  Read-ahead only takes added buffers, so that it can
+// never use up the fixed ones.  Caller holds bcache.evict.
+static struct buf*
+brecycle(int ahead)
+{
+  struct buf *b;
+  int v;
 
-  // Not cached; recycle an unused buffer.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
+  acquire(&bcache.lock);
   for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
+    if(ahead && bfixed(b))
+      continue;
+    v = bhash(b->dev, b->blockno);
+    acquire(&bcache.bucket[v].lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      bunhash(b, v);
       b->refcnt = 1;
+      release(&bcache.bucket[v].lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
+    release(&bcache.bucket[v].lock);
   }
-  panic("bget: no buffers");
+  release(&bcache.lock);
+  return 0;
+}
+
+// Free up to n unused added buffers, least recently used
+// first, because memory is short.  Returns how many were freed.
+int
+bshrink(int n)
+{
+  struct buf *b, *prev, *list;
+  int v, nfree;
+
+  list = 0;
+  nfree = 0;
+  acquire(&bcache.evict);
+  acquire(&bcache.lock);
+  for(b = bcache.head.prev; b != &bcache.head && nfree < n; b = prev){
+    prev = b->prev;
+    if(bfixed(b))
+      continue;
+    v = bhash(b->dev, b->blockno);
+    acquire(&bcache.bucket[v].lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      bunhash(b, v);
+      b->next->prev = b->prev;
+      b->prev->next = b->next;
+      b->next = list;
+      list = b;
+      nfree++;
+    }
+    release(&bcache.bucket[v].lock);
+  }
+  bcache.nbuf -= nfree;
+  bcache.nshrink += nfree;
+  release(&bcache.lock);
+  release(&bcache.evict);
+
+  for(; list; list = b){
+    b = list->next;
+    if(bcache.datacache)
+      kmem_cache_free(bcache.datacache, list->data);
+    else
+      kfree((char*)list->data);
+    kmem_cache_free(bcache.cache, list);
+  }
+  return nfree;
+}
+
+// Switch to the block size n of the file system, once its
+// super block has been read.  Drops every cached block.
+void
+bsetsize(uint n)
+{
+  if(n < MINBSIZE || n > MAXBSIZE || (n & (n-1)) || bcache.sized)
+    panic("bsetsize");
+  bdrop();
+  bsize = n;
+  if(n < PGSIZE)
+    bcache.datacache = kmem_cache_create("bufdata", n);
+  bcache.sized = 1;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -98,13 +345,33 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if((b->flags & B_VALID) == 0) {
     iderw(b);
   }
   return b;
 }
 
+// Return a locked buf for the indicated block without reading
+// it, for a caller that is about to overwrite all of it.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  return bget(dev, blockno, 0);
+}
+
+// Start reading a block that will probably be needed soon,
+// unless it is cached already, and return without waiting.
+// The buffer is released by bdone() when the read completes.
+void
+breada(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) != 0)
+    iderwasync(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,6 +382,8 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+static void bunref(struct buf*);
+
 // Release a locked buffer.
 // Move to the head of the MRU list.
 void
@@ -124,8 +393,37 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bunref(b);
+}
+
+// Release a buffer after an asynchronous read finished.
+// Called by the disk driver, from the interrupt handler.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bunref(b);
+}
 
+// Drop a reference to b.
+static void
+bunref(struct buf *b)
+{
+  int h;
+
+  h = bhash(b->dev, b->blockno);
+  acquire(&bcache.bucket[h].lock);
+  if (b->refcnt > 1) {
+    b->refcnt--;
+    release(&bcache.bucket[h].lock);
+    return;
+  }
+  release(&bcache.bucket[h].lock);
+
+  // Dropping the last reference lets bshrink() free b, so it
+  // must be moved on the LRU list in the same step.
   acquire(&bcache.lock);
+  acquire(&bcache.bucket[h].lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
@@ -136,8 +434,100 @@ brelse(struct buf *b)
     bcache.head.next->prev = b;
     bcache.head.next = b;
   }
-  
+  release(&bcache.bucket[h].lock);
+  release(&bcache.lock);
+}
+
+// Forget every unused, clean block, so that the next reads
+// of them go to the disk.
+void
+bdrop(void)
+{
+  struct buf *b;
+  int v;
+
+  bshrink(bcache.nbuf);
+  acquire(&bcache.evict);
+  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+    v = bhash(b->dev, b->blockno);
+    acquire(&bcache.bucket[v].lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      bunhash(b, v);
+      b->flags = 0;
+    }
+    release(&bcache.bucket[v].lock);
+  }
+  release(&bcache.evict);
+}
+
+// Forget block blockno of dev if it is cached, unused and
+// clean.
+void
+bforget(uint dev, uint blockno)
+{
+  struct buf *b;
+  int v;
+
+  v = bhash(dev, blockno);
+  acquire(&bcache.evict);
+  acquire(&bcache.bucket[v].lock);
+  for(b = bcache.bucket[v].head; b; b = b->hnext){
+    if(b->dev == dev && b->blockno == blockno){
+      if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+        bunhash(b, v);
+        b->flags = 0;
+      }
+      break;
+    }
+  }
+  release(&bcache.bucket[v].lock);
+  release(&bcache.evict);
+}
+
+// Count the buffers pinned dirty by the log.
+int
+bdirty(void)
+{
+  struct buf *b;
+  int n;
+
+  n = 0;
+  acquire(&bcache.lock);
+  for(b = bcache.head.next; b != &bcache.head; b = b->next)
+    if(b->flags & B_DIRTY)
+      n++;
   release(&bcache.lock);
+  return n;
+}
+
+void
+report_bcache_stats(void)
+{
+  struct buf *b;
+  uint nhit, nmiss, nahead, n, longest;
+  int i;
+
+  nhit = nmiss = nahead = longest = 0;
+  for(i = 0; i < NBUCKET; i++){
+    acquire(&bcache.bucket[i].lock);
+    nhit += bcache.bucket[i].nhit;
+    nmiss += bcache.bucket[i].nmiss;
+    nahead += bcache.bucket[i].nahead;
+    n = 0;
+    for(b = bcache.bucket[i].head; b; b = b->hnext)
+      n++;
+    if(n > longest)
+      longest = n;
+    release(&bcache.bucket[i].lock);
+  }
+  cprintf("bcache: %d-byte blocks, %d buffers (%d fixed, at most %d), %d KB\n",
+          bsize, bcache.nbuf, NBUF, BMAX,
+          bcache.nbuf * (sizeof(struct buf) + bsize) / 1024);
+  cprintf("bcache: %d hits, %d misses, hit rate %d%%, longest chain %d\n",
+          nhit, nmiss, nhit + nmiss ? nhit * 100 / (nhit + nmiss) : 0, longest);
+  cprintf("bcache: %d blocks read ahead\n", nahead);
+  cprintf("bcache: %d buffers added, %d freed under memory pressure\n",
+          bcache.ngrow, bcache.nshrink);
 }
 //PAGEBREAK!
 // Blank page.
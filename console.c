@@ -818,10 +818,14 @@ int
 consoleread(struct inode *ip, char *dst, int n)
 {
   uint target;
-  int c;
+  int c, m;
+  char kbuf[INPUT_BUF];
 
   iunlock(ip);
   target = n;
+  // dst may fault and sleep to swap in, so collect input in
+  // kbuf and copy it out with cons.lock released.
+  m = 0;
   acquire(&cons.lock);
   while(n > 0){
     while(input.r == input.w){
@@ -841,8 +845,18 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
-    *dst++ = c;
+    kbuf[m++] = c;
     --n;
+    if(m == sizeof(kbuf) && c != '\n'){
+      release(&cons.lock);
+      if(ucopy(dst, kbuf, m) < 0){
+        ilock(ip);
+        return -1;
+      }
+      dst += m;
+      m = 0;
+      acquire(&cons.lock);
+    }
     if(c == '\n')
     {
       _history[_MOD(_last_history++,_N_HISTORY)]=input;
@@ -853,6 +867,10 @@ consoleread(struct inode *ip, char *dst, int n)
     }
   }
   release(&cons.lock);
+  if(ucopy(dst, kbuf, m) < 0){
+    ilock(ip);
+    return -1;
+  }
   ilock(ip);
 
   return target - n;
@@ -861,13 +879,25 @@ consoleread(struct inode *ip, char *dst, int n)
 int
 consolewrite(struct inode *ip, char *buf, int n)
 {
-  int i;
+  int i, j, m;
+  char kbuf[128];
 
   iunlock(ip);
-  acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
-  release(&cons.lock);
+  // buf may fault and sleep to swap in, so copy it out
+  // before taking cons.lock.
+  for(i = 0; i < n; i += m){
+    m = n - i;
+    if(m > sizeof(kbuf))
+      m = sizeof(kbuf);
+    if(ucopy(kbuf, buf + i, m) < 0){
+      ilock(ip);
+      return -1;
+    }
+    acquire(&cons.lock);
+    for(j = 0; j < m; j++)
+      consputc(kbuf[j] & 0xff);
+    release(&cons.lock);
+  }
   ilock(ip);
 
   return n;
@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct reentrantlock;
@@ -12,10 +13,20 @@ struct stat;
 struct superblock;
 
 // bio.c
+extern uint     bsize;
 void            binit(void);
 struct buf*     bread(uint, uint);
+void            breada(uint, uint);
+struct buf*     bnew(uint, uint);
+void            bdone(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+int             bshrink(int);
+void            bdrop(void);
+void            bforget(uint, uint);
+int             bdirty(void);
+void            bsetsize(uint);
+void            report_bcache_stats(void);
 
 // console.c
 void            consoleinit(void);
@@ -34,6 +45,7 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filereadat(struct file*, char*, uint, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -47,6 +59,8 @@ void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+void            idrop(struct inode*);
+void            readahead(struct inode*, uint, uint);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
@@ -58,6 +72,12 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwasync(struct buf*);
+int             ideswappresent(void);
+void            ideswaprw(char*, uint, int);
+void            ideswapintr(void);
+int             idesetdma(int);
+void            report_ide_stats(void);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -66,9 +86,21 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kalloc_pages(int);
+char*           kalloc_zeroed(void);
+void            kzero_refill(void);
 void            kfree(char*);
+void            kfree_pages(char*, int);
+int             kreclaim(void);
+char*           kstackalloc(void);
+void            kstackfree(char*);
+void            kref(char*);
+void            ksplit(char*, int);
+int             krefcount(char*);
+uint            kfreepages(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+int             report_kalloc_stats(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -80,6 +112,7 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(int, int);
 void            microdelay(int);
 
 // log.c
@@ -87,16 +120,26 @@ void            initlog(int dev);
 void            log_write(struct buf*);
 void            begin_op();
 void            end_op();
+void            logsync(void);
+int             logsetasync(int);
+void            loginstall(void);
+void            report_log_stats(void);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+uint            pciread(int, int, int);
+void            pciwrite(int, int, int, uint);
+int             pcifind(int, int);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -109,6 +152,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            _log_syscall();
@@ -135,6 +179,8 @@ int             set_sjf_info(int,int,int);
 int             set_queue(int,int); 
 int             report_all_processes(void); 
 int             report_syscalls_count(void); 
+int             report_memory_usage(void);
+int             reclaim(void);
 int             fibonacci_number(int);
 void            calculate_factorial(int, int);
 
@@ -147,6 +193,16 @@ void            initreentrantlock(struct reentrantlock*, char*);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// ucopy.S
+int             ucopy(void*, const void*, uint);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+void            report_slab_stats(void);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -202,14 +258,44 @@ int             allocuvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
+void            tlbflush(pde_t*, uint, uint);
+void            tlbintr(void);
 int             copyout(pde_t*, uint, void*, uint);
+int             pagefault(uint, uint);
+int             residentpages(pde_t*, uint);
+int             clockscan(pde_t*, uint, uint*, int, char**, uint*);
+int             superpages(pde_t*);
+void            report_superpage_stats(void);
+void            textinit(void);
+void            textref(struct inode*);
+void            textunref(struct inode*);
+void            textdrop(struct inode*);
+void            report_text_stats(void);
 void            clearpteu(pde_t *pgdir, char *uva);
-int             open_sharedmem(int);
+uint            vmabase(struct proc*);
+uint            uvaend(struct proc*, uint);
+void            freevmas(struct proc*);
+int             copyvmas(struct proc*, struct proc*);
+int             uvaprefault(uint, uint);
+int             uvawritable(uint, uint);
+int             mmap(struct file*, uint, uint, int);
+int             munmap(uint, uint);
+int             open_sharedmem(int, int);
 int             close_sharedmem(int);
 
+// swap.c
+void            swapinit(void);
+int             swapalloc(void);
+void            swapcancel(int);
+void            swapdup(int);
+void            swapfree(int);
+void            swapout(int, char*);
+void            swapin(int, char*);
+void            swapscanned(uint, int);
+void            report_swap_stats(void);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
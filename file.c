@@ -11,15 +11,20 @@
 #include "file.h"
 
 struct devsw devsw[NDEV];
+
+// Open files come from a slab cache, so there is no
+// system-wide limit other than memory.  ftable.lock
+// protects the reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +33,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +69,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -104,14 +105,30 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      readahead(f->ip, f->off, r);
       f->off += r;
+    }
     iunlock(f->ip);
     return r;
   }
   panic("fileread");
 }
 
+// Read n bytes at offset off of inode file f into kernel
+// memory, without moving the file offset.  Used to fill
+// mmap()ed pages.  Returns the number of bytes read.
+int
+filereadat(struct file *f, char *addr, uint off, int n)
+{
+  int r;
+
+  ilock(f->ip);
+  r = readi(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r < 0 ? 0 : r;
+}
+
 //PAGEBREAK!
 // Write to file f.
 int
@@ -126,11 +143,16 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
+    // i-node, indirect blocks, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
+    // A write that crosses from one indirect block to the
+    // next touches two on every level but the root, 2*NLEVEL-1
+    // in all, and allocates at most NLEVEL of them, each with
+    // a bitmap block; every data block may need a bitmap
+    // block of its own too.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-(2*NLEVEL-1)-NLEVEL-2) / 2) * bsize;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -14,6 +14,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int ntext;          // Processes running it; see textref()
+  struct textpage *text; // Its cached text pages
+                      // (ntext and text: text cache lock)
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -22,7 +25,11 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+NLEVEL];
+
+  uint ralast;        // last block read, for read-ahead
+  uint raend;         // first block not yet read ahead
+  uint rawin;         // read-ahead window in blocks
 };
 
 // table mapping major device number to
@@ -0,0 +1,85 @@
+// Measure large sequential writes and reads, which go through
+// the double- and triple-indirect blocks.  Writes a file of
+// 4 MB by default (or argv[1] KB) in 8 KB write() calls, drops
+// its blocks from the buffer cache, and reads it back the same
+// way, checking every chunk; the reads are done with disk DMA
+// off and, if the disk can do it, on.  Prints the elapsed ticks
+// of each, and the disk statistics, which count PIO copying
+// cycles.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define CHUNK 8192
+
+char buf[CHUNK];
+
+// Read the file back from a cold cache and check it.
+void
+readback(int nchunk, char *mode)
+{
+  int fd, i, n;
+  uint t;
+
+  if((fd = open("filebench.tmp", O_RDONLY)) < 0){
+    printf(1, "filebench: cannot open filebench.tmp\n");
+    exit();
+  }
+  drop_bcache(fd);
+  t = uptime();
+  for(i = 0; (n = read(fd, buf, CHUNK)) > 0; i++){
+    if(n != CHUNK || ((int*)buf)[0] != i){
+      printf(1, "filebench: chunk %d read back wrong\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  if(i != nchunk){
+    printf(1, "filebench: read %d chunks, expected %d\n", i, nchunk);
+    exit();
+  }
+  printf(1, "filebench: %s: read %d KB in %d ticks\n",
+         mode, nchunk * (CHUNK / 1024), uptime() - t);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, nchunk, dma;
+  uint t;
+
+  nchunk = 4096 / (CHUNK / 1024);
+  if(argc > 1)
+    nchunk = atoi(argv[1]) / (CHUNK / 1024);
+
+  if((fd = open("filebench.tmp", O_CREATE|O_RDWR)) < 0){
+    printf(1, "filebench: cannot create filebench.tmp\n");
+    exit();
+  }
+  t = uptime();
+  for(i = 0; i < nchunk; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, CHUNK) != CHUNK){
+      printf(1, "filebench: write of chunk %d failed\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  printf(1, "filebench: wrote %d KB in %d ticks\n",
+         nchunk * (CHUNK / 1024), uptime() - t);
+
+  dma = set_idedma(0);
+  readback(nchunk, "PIO");
+  if(dma >= 0){
+    set_idedma(1);
+    readback(nchunk, "DMA");
+    set_idedma(dma);
+  }
+
+  unlink("filebench.tmp");
+  report_bcache_stats();
+  report_disk_stats();
+  exit();
+}
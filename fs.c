@@ -33,8 +33,8 @@ readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
 
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  bp = bread(dev, SBOFF / bsize);
+  memmove(sb, bp->data + SBOFF % bsize, sizeof(*sb));
   brelse(bp);
 }
 
@@ -45,7 +45,7 @@ bzero(int dev, int bno)
   struct buf *bp;
 
   bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  memset(bp->data, 0, bsize);
   log_write(bp);
   brelse(bp);
 }
@@ -60,9 +60,9 @@ balloc(uint dev)
   struct buf *bp;
 
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
+  for(b = 0; b < sb.size; b += BPB(sb.bsize)){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+    for(bi = 0; bi < BPB(sb.bsize) && b + bi < sb.size; bi++){
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
@@ -85,7 +85,7 @@ bfree(int dev, uint b)
   int bi, m;
 
   bp = bread(dev, BBLOCK(b, sb));
-  bi = b % BPB;
+  bi = b % BPB(sb.bsize);
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
@@ -179,10 +179,11 @@ iinit(int dev)
   }
 
   readsb(dev, &sb);
+  bsetsize(sb.bsize);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize);
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -200,7 +201,7 @@ ialloc(uint dev, short type)
 
   for(inum = 1; inum < sb.ninodes; inum++){
     bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
+    dip = (struct dinode*)bp->data + inum%IPB(sb.bsize);
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
@@ -224,7 +225,7 @@ iupdate(struct inode *ip)
   struct dinode *dip;
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-  dip = (struct dinode*)bp->data + ip->inum%IPB;
+  dip = (struct dinode*)bp->data + ip->inum%IPB(sb.bsize);
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
@@ -266,6 +267,9 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ralast = -1;
+  ip->raend = 0;
+  ip->rawin = 0;
   release(&icache.lock);
 
   return ip;
@@ -297,7 +301,7 @@ ilock(struct inode *ip)
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
-    dip = (struct dinode*)bp->data + ip->inum%IPB;
+    dip = (struct dinode*)bp->data + ip->inum%IPB(sb.bsize);
     ip->type = dip->type;
     ip->major = dip->major;
     ip->minor = dip->minor;
@@ -365,15 +369,19 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the next NINDIRECT^2
+// in the blocks listed in block ip->addrs[NDIRECT+1] (double
+// indirect), and the next NINDIRECT^3 one level further down
+// from ip->addrs[NDIRECT+2] (triple indirect).
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, span;
   struct buf *bp;
+  int level;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
@@ -382,21 +390,54 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  // Find the tree holding bn; span is the number of data
+  // blocks it covers.
+  span = NINDIRECT(bsize);
+  for(level = 0; bn >= span; level++){
+    if(level == NLEVEL - 1)
+      panic("bmap: out of range");
+    bn -= span;
+    span *= NINDIRECT(bsize);
+  }
+
+  // Walk down from its root, allocating blocks as necessary.
+  if((addr = ip->addrs[NDIRECT+level]) == 0)
+    ip->addrs[NDIRECT+level] = addr = balloc(ip->dev);
+  do {
+    span /= NINDIRECT(bsize);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn / span]) == 0){
+      a[bn / span] = addr = balloc(ip->dev);
       log_write(bp);
     }
     brelse(bp);
-    return addr;
-  }
+    bn %= span;
+  } while(span > 1);
+  return addr;
+}
 
-  panic("bmap: out of range");
+// Free indirect block addr and the blocks below it; depth 0
+// means that it lists data blocks.
+static void
+bfreetree(uint dev, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT(bsize); j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 0)
+      bfreetree(dev, a[j], depth - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -407,9 +448,7 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -418,22 +457,56 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < NLEVEL; i++){
+    if(ip->addrs[NDIRECT+i]){
+      bfreetree(ip->dev, ip->addrs[NDIRECT+i], i);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
   ip->size = 0;
   iupdate(ip);
 }
 
+// Forget the cached copies of indirect block addr and the
+// blocks below it; depth 0 means that it lists data blocks.
+static void
+bforgettree(uint dev, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT(bsize); j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 0)
+      bforgettree(dev, a[j], depth - 1);
+    else
+      bforget(dev, a[j]);
+  }
+  brelse(bp);
+  bforget(dev, addr);
+}
+
+// Forget the cached blocks of ip that are not in use or
+// dirty, so that the next reads of them go to the disk.
+// For measuring cold-cache reads.  Caller holds ip->lock.
+void
+idrop(struct inode *ip)
+{
+  int i;
+
+  for(i = 0; i < NDIRECT; i++)
+    if(ip->addrs[i])
+      bforget(ip->dev, ip->addrs[i]);
+  for(i = 0; i < NLEVEL; i++)
+    if(ip->addrs[NDIRECT+i])
+      bforgettree(ip->dev, ip->addrs[NDIRECT+i], i);
+}
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -447,6 +520,47 @@ stati(struct inode *ip, struct stat *st)
 }
 
 //PAGEBREAK!
+// Read-ahead for read() of regular files; directory lookups
+// and program loading read through readi() without it.
+// fileread() reports each read of n bytes at off here, and the
+// inode remembers the last block read.  A read that moves on to
+// the next block is taken as sequential: the window doubles,
+// from RAMIN up to the process's limit, and the blocks in the
+// window beyond the read are fetched in the background with
+// breada().  Any other read closes the window.
+// Caller must hold ip->lock.
+void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, end, max, first, last;
+
+  if(n == 0 || ip->type != T_FILE)
+    return;
+  first = off / bsize;
+  last = (off + n - 1) / bsize;
+  max = myproc() ? myproc()->readahead : 0;
+  if(first == ip->ralast + 1){
+    ip->rawin = ip->rawin ? ip->rawin * 2 : RAMIN;
+    if(ip->rawin > max)
+      ip->rawin = max;
+  } else if(first != ip->ralast){
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ralast = last;
+  if(ip->rawin == 0)
+    return;
+
+  end = last + 1 + ip->rawin;
+  if(end > (ip->size + bsize - 1) / bsize)
+    end = (ip->size + bsize - 1) / bsize;
+  bn = ip->raend > last + 1 ? ip->raend : last + 1;
+  for(; bn < end; bn++)
+    breada(ip->dev, bmap(ip, bn));
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 int
@@ -465,11 +579,16 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n == 0)
+    return 0;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
+    bp = bread(ip->dev, bmap(ip, off/bsize));
+    m = min(n - tot, bsize - off%bsize);
+    if(ucopy(dst, bp->data + off%bsize, m) < 0){
+      brelse(bp);
+      return -1;
+    }
     brelse(bp);
   }
   return n;
@@ -483,6 +602,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int r;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -490,24 +610,30 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return devsw[ip->major].write(ip, src, n);
   }
 
+  // Cached pages of a program must not outlive its contents.
+  textdrop(ip);
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(off + n > MAXFILE(bsize)*(unsigned long long)bsize)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
+    bp = bread(ip->dev, bmap(ip, off/bsize));
+    m = min(n - tot, bsize - off%bsize);
+    // Log the block even if src faulted part way, since part
+    // of it may have been copied.
+    r = ucopy(bp->data + off%bsize, src, m);
     log_write(bp);
     brelse(bp);
+    if(r < 0)
+      break;
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return tot < n ? -1 : n;
 }
 
 //PAGEBREAK!
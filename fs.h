@@ -3,12 +3,20 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#define MINBSIZE 512   // smallest block size, one disk sector
+#define MAXBSIZE 4096  // largest block size
+#define SBOFF    512   // byte offset of the super block on disk
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
 //                                          free bit map | data blocks]
 //
+// The block size, a power of two from MINBSIZE to MAXBSIZE, is
+// chosen by mkfs.  The super block is always at byte SBOFF, so
+// that it can be found before the block size is known; with
+// blocks larger than a sector that is inside block 0, and
+// block 1 is unused.
+//
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
 struct superblock {
@@ -19,11 +27,17 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size in bytes
 };
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// An inode lists NDIRECT data blocks, then the roots of
+// NLEVEL trees of indirect blocks: single, double and triple.
+#define NDIRECT 10
+#define NLEVEL  3
+#define NINDIRECT(bsize) ((bsize) / sizeof(uint))
+#define MAXFILE(bsize) (NDIRECT + NINDIRECT(bsize) + \
+                        NINDIRECT(bsize) * NINDIRECT(bsize) + \
+                        NINDIRECT(bsize) * NINDIRECT(bsize) * NINDIRECT(bsize))
 
 // On-disk inode structure
 struct dinode {
@@ -32,20 +46,20 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+NLEVEL];   // Data block addresses
 };
 
 // Inodes per block.
-#define IPB           (BSIZE / sizeof(struct dinode))
+#define IPB(bsize)    ((bsize) / sizeof(struct dinode))
 
 // Block containing inode i
-#define IBLOCK(i, sb)     ((i) / IPB + sb.inodestart)
+#define IBLOCK(i, sb)     ((i) / IPB(sb.bsize) + sb.inodestart)
 
 // Bitmap bits per block
-#define BPB           (BSIZE*8)
+#define BPB(bsize)    ((bsize)*8)
 
 // Block of free map containing bit for block b
-#define BBLOCK(b, sb) (b/BPB + sb.bmapstart)
+#define BBLOCK(b, sb) (b/BPB(sb.bsize) + sb.bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code.  Blocks move by bus-master DMA when the PCI
+// IDE controller supports it, and by PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -23,30 +24,97 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+#define IDE_CMD_SETMUL 0xc6
+
+// Bus-master DMA registers of the primary channel, at the I/O
+// base in BAR4 of the PCI IDE controller.  The controller takes
+// a table of PRDs, each giving a piece of memory to transfer.
+// http://wiki.osdev.org/ATA/ATAPI_using_DMA
+#define BM_CMD        0      // command register
+#define BM_STATUS     2      // status register
+#define BM_PRDT       4      // physical address of the PRD table
+#define BM_START      0x01   // command: start transfer
+#define BM_READ       0x08   // command: transfer from disk to memory
+#define BM_ERR        0x02   // status: error
+#define BM_INTR       0x04   // status: interrupt
+
+#define IDE_MAXSECT   128    // most sectors moved by one DMA command
+#define IDE_MULTSECT  16     // sectors per interrupt of READ/WRITE MULTIPLE
+
+struct prd {
+  uint addr;      // physical address
+  ushort len;     // bytes; a piece may not cross a 64KB boundary
+  ushort flags;
+};
+#define PRD_EOT       0x8000 // last entry of the table
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
+// The command in progress moves the first idenbuf bufs of it,
+// which are consecutive blocks.  The rest of the queue is kept
+// in C-SCAN order by ideenqueue(), which puts the blocks of a
+// run next to each other so that one command can move them.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idenbuf;
+static int idedepth;       // bufs in idequeue
+static int multsect;       // most sectors per PIO command
+
+static int bmbase;         // bus-master registers, 0 if there is no DMA
+static int usedma;         // start new commands with DMA
+static int curdma;         // the command in progress uses DMA
+static struct prd *prdt;   // PRD table; one page, never crosses 64KB
+
+static struct {
+  uint ndmacmd;            // DMA commands
+  uint ndmablk;            // blocks moved by DMA
+  uint npiocmd;            // PIO commands
+  uint npioblk;            // blocks moved by PIO
+  uint nmerged;            // blocks that joined another's command
+  uint nreq;               // requests queued
+  uint depthsum;           // sum of idedepth as each was queued
+  uint maxdepth;
+  unsigned long long piocycles;  // cycles spent in insl/outsl
+} idestats;
 
 static int havedisk1;
 static void idestart(struct buf*);
 
-// Wait for IDE disk to become ready.
+// The swap disk is the master of the secondary channel.
+// It is used one page at a time, for swap.c, and does not
+// go through the buffer cache.
+#define SWAPBASE      0x170  // secondary channel command block
+#define SWAPCTL       0x376  // secondary channel control register
+
+static struct sleeplock swaplock;  // one swap request at a time
+static struct spinlock swapintrlock;
+static int swapbusy;               // request waiting for its interrupt
+static int haveswap;
+
+// Wait for the IDE disk on the channel at base to become ready.
 static int
-idewait(int checkerr)
+idewaitport(int base, int checkerr)
 {
   int r;
 
-  while(((r = inb(0x1f7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+  while(((r = inb(base+7)) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
     ;
   if(checkerr && (r & (IDE_DF|IDE_ERR)) != 0)
     return -1;
   return 0;
 }
 
+// Wait for IDE disk to become ready.
+static int
+idewait(int checkerr)
+{
+  return idewaitport(0x1f0, checkerr);
+}
+
 void
 ideinit(void)
 {
@@ -67,33 +135,187 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Check for the swap disk.  An empty channel floats high.
+  initsleeplock(&swaplock, "swapdisk");
+  initlock(&swapintrlock, "swapintr");
+  outb(SWAPBASE+6, 0xe0 | (0<<4));
+  for(i=0; i<1000; i++){
+    int r = inb(SWAPBASE+7);
+    if(r != 0 && r != 0xff){
+      haveswap = 1;
+      break;
+    }
+  }
+  if(haveswap){
+    ioapicenable(IRQ_IDE2, ncpu - 1);
+    idewaitport(SWAPBASE, 0);
+  }
+
+  // Have READ/WRITE MULTIPLE move up to IDE_MULTSECT sectors
+  // per interrupt, so that PIO commands can cover several
+  // blocks.  If the disks refuse, a command moves one block.
+  multsect = IDE_MULTSECT;
+  for(i = 0; i <= havedisk1; i++){
+    outb(0x3f6, 2);  // no interrupt
+    outb(0x1f2, IDE_MULTSECT);
+    outb(0x1f6, 0xe0 | (i<<4));
+    outb(0x1f7, IDE_CMD_SETMUL);
+    if(idewait(1) < 0)
+      multsect = 0;
+  }
+  outb(0x1f6, 0xe0 | (0<<4));
+
+  // Use bus-master DMA if there is a PCI IDE controller with
+  // an I/O base for it.  Otherwise stay with PIO.
+  int pci = pcifind(0x01, 0x01);
+  if(pci >= 0){
+    uint bar = pciread(pci>>3, pci&7, 0x20);
+    if((bar & 1) && (bar & ~3) != 0 && (prdt = (struct prd*)kalloc()) != 0){
+      // Enable I/O space and bus mastering.
+      pciwrite(pci>>3, pci&7, 0x04, (pciread(pci>>3, pci&7, 0x04) & 0xffff) | 0x5);
+      bmbase = bar & ~3;
+      usedma = 1;
+    }
+  }
+  cprintf("ide: %s\n", usedma ? "bus-master DMA" : "PIO");
 }
 
-// Start the request for b.  Caller must hold idelock.
+int
+ideswappresent(void)
+{
+  return haveswap;
+}
+
+// Read or write one page at page slot of the swap disk,
+// sleeping until the disk is done.
+void
+ideswaprw(char *page, uint slot, int write)
+{
+  int sector = slot * (PGSIZE/SECTOR_SIZE);
+
+  if(!haveswap || slot >= SWAPPAGES)
+    panic("ideswaprw");
+
+  acquiresleep(&swaplock);
+  acquire(&swapintrlock);
+  idewaitport(SWAPBASE, 0);
+  outb(SWAPCTL, 0);  // generate interrupt
+  outb(SWAPBASE+2, PGSIZE/SECTOR_SIZE);  // number of sectors
+  outb(SWAPBASE+3, sector & 0xff);
+  outb(SWAPBASE+4, (sector >> 8) & 0xff);
+  outb(SWAPBASE+5, (sector >> 16) & 0xff);
+  outb(SWAPBASE+6, 0xe0 | ((sector>>24)&0x0f));
+  swapbusy = 1;
+  if(write){
+    outb(SWAPBASE+7, IDE_CMD_WRMUL);
+    outsl(SWAPBASE, page, PGSIZE/4);
+  } else {
+    outb(SWAPBASE+7, IDE_CMD_RDMUL);
+  }
+  while(swapbusy)
+    sleep(&swapbusy, &swapintrlock);
+  if(!write && idewaitport(SWAPBASE, 1) >= 0)
+    insl(SWAPBASE, page, PGSIZE/4);
+  release(&swapintrlock);
+  releasesleep(&swaplock);
+}
+
+// Swap disk interrupt handler.
+void
+ideswapintr(void)
+{
+  acquire(&swapintrlock);
+  inb(SWAPBASE+7);  // acknowledge
+  swapbusy = 0;
+  wakeup(&swapbusy);
+  release(&swapintrlock);
+}
+
+// Can b follow a in one command?
+static int
+idenext(struct buf *a, struct buf *b)
+{
+  return b->dev == a->dev && b->blockno == a->blockno + 1 &&
+         (b->flags & B_DIRTY) == (a->flags & B_DIRTY);
+}
+
+// Fill the PRD table with the data of the nbuf bufs from b on.
+static void
+prdfill(struct buf *b, int nbuf)
+{
+  struct prd *p;
+  uint pa, n, len;
+
+  p = prdt;
+  for(; nbuf > 0; nbuf--, b = b->qnext){
+    for(pa = V2P(b->data), n = bsize; n > 0; pa += len, n -= len){
+      len = ((pa + 0x10000) & ~0xffff) - pa;  // to the 64KB boundary
+      if(len > n)
+        len = n;
+      p->addr = pa;
+      p->len = len;
+      p->flags = 0;
+      p++;
+    }
+  }
+  p[-1].flags = PRD_EOT;
+}
+
+// Start the request for b, and for as many of the bufs queued
+// after it as continue its run of blocks and fit in a command.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *e;
+  unsigned long long t;
+  int i;
+
   if(b == 0)
     panic("idestart");
   if(b->blockno >= FSSIZE)
     panic("incorrect blockno");
-  int sector_per_block =  BSIZE/SECTOR_SIZE;
+  int sector_per_block =  bsize/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int read_cmd, write_cmd, maxsect;
+
+  if (sector_per_block > MAXBSIZE/SECTOR_SIZE) panic("idestart");
 
-  if (sector_per_block > 7) panic("idestart");
+  curdma = usedma;
+  maxsect = curdma ? IDE_MAXSECT : multsect;
+  idenbuf = 1;
+  for(e = b; e->qnext && idenext(e, e->qnext) &&
+      (idenbuf+1)*sector_per_block <= maxsect; e = e->qnext)
+    idenbuf++;
+  read_cmd = (idenbuf*sector_per_block == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
+  write_cmd = (idenbuf*sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  idestats.nmerged += idenbuf - 1;
+  if(curdma){
+    read_cmd = IDE_CMD_RDDMA;
+    write_cmd = IDE_CMD_WRDMA;
+    prdfill(b, idenbuf);
+    outl(bmbase+BM_PRDT, V2P(prdt));
+    outb(bmbase+BM_STATUS, BM_ERR|BM_INTR);  // clear
+    outb(bmbase+BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_READ);
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, idenbuf * sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(curdma){
+    outb(0x1f7, (b->flags & B_DIRTY) ? write_cmd : read_cmd);
+    outb(bmbase+BM_CMD, ((b->flags & B_DIRTY) ? 0 : BM_READ) | BM_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    t = rdtsc();
+    for(e = b, i = 0; i < idenbuf; e = e->qnext, i++)
+      outsl(0x1f0, e->data, bsize/4);
+    idestats.piocycles += rdtsc() - t;
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,31 +325,142 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *done;
+  unsigned long long t;
+  int i, st;
 
-  // First queued buffer is the active request.
+  // First queued buffers are the active request.
   acquire(&idelock);
 
   if((b = idequeue) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(curdma){
+    st = inb(bmbase+BM_STATUS);
+    outb(bmbase+BM_CMD, 0);  // stop
+    outb(bmbase+BM_STATUS, BM_ERR|BM_INTR);  // clear
+    if((st & BM_ERR) || idewait(1) < 0){
+      // Give up on DMA and do the request again with PIO.
+      cprintf("ide: DMA error, using PIO\n");
+      usedma = 0;
+      idestart(idequeue);
+      release(&idelock);
+      return;
+    }
+    idestats.ndmacmd++;
+    idestats.ndmablk += idenbuf;
+  } else {
+    // Read data if needed.
+    if(!(b->flags & B_DIRTY) && idewait(1) >= 0){
+      t = rdtsc();
+      for(i = 0; i < idenbuf; b = b->qnext, i++)
+        insl(0x1f0, b->data, bsize/4);
+      idestats.piocycles += rdtsc() - t;
+    }
+    idestats.npiocmd++;
+    idestats.npioblk += idenbuf;
+  }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  done = 0;
+  for(i = 0; i < idenbuf; i++){
+    b = idequeue;
+    idequeue = b->qnext;
+    idedepth--;
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      b->qnext = done;
+      done = b;
+    }
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
     idestart(idequeue);
 
   release(&idelock);
+
+  // Nobody waits for a read-ahead buffer; release it.
+  while((b = done) != 0){
+    done = b->qnext;
+    bdone(b);
+  }
+}
+
+// Turn DMA on or off for later requests.  Returns whether it
+// was on, or -1 if the controller cannot do DMA.
+int
+idesetdma(int on)
+{
+  int old;
+
+  if(bmbase == 0)
+    return -1;
+  acquire(&idelock);
+  old = usedma;
+  usedma = (on != 0);
+  release(&idelock);
+  return old;
+}
+
+void
+report_ide_stats(void)
+{
+  acquire(&idelock);
+  cprintf("ide: %s, %d DMA commands moved %d blocks\n",
+          usedma ? "DMA" : "PIO", idestats.ndmacmd, idestats.ndmablk);
+  cprintf("ide: %d PIO commands moved %d blocks, %d Kcycles copying\n",
+          idestats.npiocmd, idestats.npioblk, (uint)(idestats.piocycles >> 10));
+  cprintf("ide: %d requests, %d merged into another's command\n",
+          idestats.nreq, idestats.nmerged);
+  cprintf("ide: queue depth %d now, %d max, %d/%d average\n", idedepth,
+          idestats.maxdepth, idestats.depthsum, idestats.nreq);
+  release(&idelock);
+}
+
+// Is a served before b, in a sweep starting at block pos?
+static int
+idebefore(struct buf *a, struct buf *b, uint pos)
+{
+  int wa = a->blockno < pos, wb = b->blockno < pos;
+
+  if(wa != wb)
+    return wa < wb;
+  return a->blockno <= b->blockno;
+}
+
+// Add b to idequeue in C-SCAN order: upward in block number
+// from the command in progress, then from the lowest block
+// upward again.  The bufs of that command stay in front.
+// Caller must hold idelock.
+static void
+ideenqueue(struct buf *b)
+{
+  struct buf **pp;
+  uint pos;
+  int i;
+
+  pp = &idequeue;
+  if(idequeue){
+    pos = idequeue->blockno;
+    for(i = 0; i < idenbuf; i++)
+      pp = &(*pp)->qnext;
+    for(; *pp && idebefore(*pp, b, pos); pp = &(*pp)->qnext)
+      ;
+  }
+  b->qnext = *pp;
+  *pp = b;
+
+  idedepth++;
+  idestats.nreq++;
+  idestats.depthsum += idedepth;
+  if(idedepth > idestats.maxdepth)
+    idestats.maxdepth = idedepth;
 }
 
 //PAGEBREAK!
@@ -137,7 +470,6 @@ ideintr(void)
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -148,11 +480,7 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  ideenqueue(b);  //DOC:insert-queue
 
   // Start disk if necessary.
   if(idequeue == b)
@@ -166,3 +494,24 @@ iderw(struct buf *b)
 
   release(&idelock);
 }
+
+// Start reading locked buf b from disk without waiting.
+// ideintr() releases it with bdone() once it is valid.
+void
+iderwasync(struct buf *b)
+{
+
+  if(!holdingsleep(&b->lock))
+    panic("iderwasync: buf not locked");
+  if(b->flags & (B_VALID|B_DIRTY))
+    panic("iderwasync: not a read");
+  if(b->dev != 0 && !havedisk1)
+    panic("iderwasync: ide disk 1 not present");
+
+  acquire(&idelock);
+  b->flags |= B_ASYNC;
+  ideenqueue(b);
+  if(idequeue == b)
+    idestart(b);
+  release(&idelock);
+}
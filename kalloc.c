@@ -1,28 +1,112 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers.
+//
+// Free memory is managed by a binary buddy allocator that
+// hands out physically contiguous blocks of 2^order pages,
+// 0 <= order <= MAXORDER, and merges a freed block with its
+// buddy whenever both halves are free.  kalloc_pages() and
+// kfree_pages() give access to multi-page blocks.
+//
+// Single 4096-byte pages (kalloc()/kfree()) are served from a
+// small cache on each CPU so that the common path does not touch
+// the buddy lists.  A CPU cache is refilled from, and drained
+// to, the buddy allocator KCACHE_BATCH pages at a time, so
+// kmem.lock is taken once per batch instead of once per page.
+//
+// Pages from kalloc() carry a reference count so that they can
+// be mapped into several address spaces (copy-on-write fork).
+// kalloc() sets it to 1, kref() adds a reference, and kfree()
+// drops one, freeing the page only when the last one is gone.
+//
+// When no page is free, kalloc() and kalloc_pages() shrink the
+// buffer cache, which grows into free memory, and try once more
+// (see kreclaim()).
+//
+// Idle CPUs keep a pool of pre-zeroed pages topped up (see
+// kzero_refill()), so that kalloc_zeroed() on the page fault
+// and sbrk paths usually does not have to clear a page.
+//
+// Building with JUNKFILL defined fills freed memory with junk
+// to catch dangling references; it is off by default because it
+// touches every page a second time.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "x86.h"
+#include "proc.h"
 #include "spinlock.h"
 
+#define KCACHE_BATCH 16  // pages moved between a CPU cache and the buddy lists
+#define KCACHE_MAX   64  // drain a CPU cache once it holds more than this
+#define ZPOOL_MAX   256  // pre-zeroed pages kept by idle CPUs
+#define ZPOOL_BATCH   8  // pages zeroed per call to kzero_refill()
+
+#define NPHYSPAGES  (PHYSTOP/PGSIZE)
+#define PG_FREE     0x80  // pageorder[]: page heads a free buddy block
+#define PG_ORDER    0x7f  // pageorder[]: order of that block
+
 void freerange(void *vstart, void *vend);
+static void freeblock(char*, int);
+static void drainall(void);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+// A free block.  Buddy free lists are circular and doubly
+// linked through next/prev so that a buddy can be unlinked
+// when it is merged; CPU caches only use next.
 struct run {
   struct run *next;
+  struct run *prev;
+};
+
+// Per-CPU page cache.  The lock is almost never contended:
+// only its own CPU uses it, except when another CPU has run
+// out of memory and steals pages.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  uint nalloc;    // kalloc() calls served on this CPU
+  uint nkfree;    // kfree() calls made on this CPU
+  uint nrefill;   // batches taken from the buddy lists
+  uint ndrain;    // batches given back to the buddy lists
+  uint nsteal;    // pages taken from other CPUs' caches
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run free[MAXORDER+1];  // list heads, one per order
+  uint nfree[MAXORDER+1];       // free blocks of each order
+  uint nsplit;                  // blocks split to satisfy a request
+  uint nmerge;                  // buddies merged on free
+  uint nfail;                   // kalloc_pages() requests that failed
+  uint nlock;       // acquisitions of kmem.lock after boot
+  uint ncontended;  // acquisitions that found kmem.lock held
+  struct kcache cache[NCPU];
 } kmem;
 
+// Pool of pre-zeroed pages.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+  uint nhit;     // kalloc_zeroed() served from the pool
+  uint nmiss;    // kalloc_zeroed() had to clear a page itself
+  uint nzeroed;  // pages cleared by idle CPUs
+} zpool;
+
+// Buddy state of every physical page, indexed by page number.
+static uchar pageorder[NPHYSPAGES];
+
+// References to every page handed out by kalloc(), indexed by
+// page number.  Updated with atomic instructions, not locks.
+static ushort pageref[NPHYSPAGES];
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,7 +115,14 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
+  for(i = 0; i <= MAXORDER; i++)
+    kmem.free[i].next = kmem.free[i].prev = &kmem.free[i];
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem.cache[i].lock, "kcache");
+  initlock(&zpool.lock, "zpool");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -43,37 +134,337 @@ kinit2(void *vstart, void *vend)
   kmem.use_lock = 1;
 }
 
+// Free [vstart, vend) in the largest aligned blocks that fit.
 void
 freerange(void *vstart, void *vend)
 {
   char *p;
+  int order;
+
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
-    kfree(p);
+  while(p + PGSIZE <= (char*)vend){
+    order = 0;
+    while(order < MAXORDER && V2P(p) % (PGSIZE << (order+1)) == 0 &&
+          p + (PGSIZE << (order+1)) <= (char*)vend)
+      order++;
+    freeblock(p, order);
+    p += PGSIZE << order;
+  }
+}
+
+// Acquire the buddy allocator lock, counting how often
+// it is taken and how often another CPU already held it.
+static void
+kmemlock(void)
+{
+  if(!kmem.use_lock)
+    return;
+  if(kmem.lock.locked)
+    kmem.ncontended++;
+  acquire(&kmem.lock);
+  kmem.nlock++;
 }
+
+static void
+kmemunlock(void)
+{
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+static void
+listpush(struct run *head, struct run *r)
+{
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+}
+
+static void
+listremove(struct run *r)
+{
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+}
+
+// Remove and return a block of 2^order pages, splitting a
+// larger block if needed.  Caller holds kmem.lock.
+static struct run*
+buddyalloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(kmem.free[k].next != &kmem.free[k])
+      break;
+  if(k > MAXORDER)
+    return 0;
+
+  r = kmem.free[k].next;
+  listremove(r);
+  kmem.nfree[k]--;
+  pageorder[V2P(r)/PGSIZE] = 0;
+
+  // Give back the upper half until the block is the right size.
+  while(k > order){
+    struct run *buddy;
+
+    k--;
+    buddy = (struct run*)((char*)r + (PGSIZE << k));
+    listpush(&kmem.free[k], buddy);
+    kmem.nfree[k]++;
+    pageorder[V2P(buddy)/PGSIZE] = PG_FREE | k;
+    kmem.nsplit++;
+  }
+  return r;
+}
+
+// Return a block of 2^order pages, merging it with its buddy
+// for as long as the buddy is also free.  Caller holds kmem.lock.
+static void
+buddyfree(char *v, int order)
+{
+  uint pa, buddy;
+
+  pa = V2P(v);
+  while(order < MAXORDER){
+    buddy = pa ^ (PGSIZE << order);
+    if(buddy >= PHYSTOP || pageorder[buddy/PGSIZE] != (PG_FREE | order))
+      break;
+    listremove((struct run*)P2V(buddy));
+    kmem.nfree[order]--;
+    pageorder[buddy/PGSIZE] = 0;
+    kmem.nmerge++;
+    if(buddy < pa)
+      pa = buddy;
+    order++;
+  }
+  listpush(&kmem.free[order], (struct run*)P2V(pa));
+  kmem.nfree[order]++;
+  pageorder[pa/PGSIZE] = PG_FREE | order;
+}
+
+// Move up to n pages from the buddy lists into cache c.
+// Caller holds c->lock.
+static void
+refill(struct kcache *c, int n)
+{
+  struct run *r;
+
+  kmemlock();
+  while(n-- > 0 && (r = buddyalloc(0)) != 0){
+    r->next = c->freelist;
+    c->freelist = r;
+    c->nfree++;
+  }
+  c->nrefill++;
+  kmemunlock();
+}
+
+// Move n pages from cache c back to the buddy lists.
+// Caller holds c->lock.
+static void
+drain(struct kcache *c, int n)
+{
+  struct run *r;
+
+  kmemlock();
+  while(n-- > 0 && (r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->nfree--;
+    buddyfree((char*)r, 0);
+  }
+  c->ndrain++;
+  kmemunlock();
+}
+
+// Take one page from another CPU's cache.  Used only when
+// both this CPU's cache and the buddy lists are empty.
+// Caller must not hold self->lock, so that two CPUs
+// stealing from each other cannot deadlock.
+static struct run*
+steal(struct kcache *self)
+{
+  struct kcache *c;
+  struct run *r;
+
+  for(c = kmem.cache; c < &kmem.cache[NCPU]; c++){
+    if(c == self)
+      continue;
+    acquire(&c->lock);
+    if((r = c->freelist) != 0){
+      c->freelist = r->next;
+      c->nfree--;
+      release(&c->lock);
+      return r;
+    }
+    release(&c->lock);
+  }
+  return 0;
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Give the block of 2^order pages at v back to the buddy
+// lists, whatever its reference count.
+static void
+freeblock(char *v, int order)
+{
+  if(order < 0 || order > MAXORDER || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+  pageref[V2P(v)/PGSIZE] = 0;
+
+#ifdef JUNKFILL
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  kmemlock();
+  buddyfree(v, order);
+  kmemunlock();
+}
+
+// Drop a reference to the block of 2^order pages of physical
+// memory pointed at by v, which must have been returned by a
+// call to kalloc_pages(order), and free it with its last one.
+void
+kfree_pages(char *v, int order)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kfree_pages");
+  if(pageref[V2P(v)/PGSIZE] == 0)
+    panic("kfree_pages: block not allocated");
+  if(__sync_sub_and_fetch(&pageref[V2P(v)/PGSIZE], 1) > 0)
+    return;
+  freeblock(v, order);
+}
+
+// Allocate a physically contiguous, naturally aligned block
+// of 2^order pages.  Returns 0 if no such block is free.
+char*
+kalloc_pages(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  kmemlock();
+  r = buddyalloc(order);
+  kmemunlock();
+  if(r == 0 && kreclaim()){
+    // The freed pages went to CPU caches; let them merge.
+    drainall();
+    kmemlock();
+    r = buddyalloc(order);
+    kmemunlock();
+  }
+  if(r)
+    pageref[V2P(r)/PGSIZE] = 1;
+  else
+    kmem.nfail++;
+  return (char*)r;
+}
+
+// Allocate a kernel stack of KSTACKSIZE bytes.  One-page
+// stacks come from the CPU caches, like any other page.
+char*
+kstackalloc(void)
+{
+  if(KSTACKORDER == 0)
+    return kalloc();
+  return kalloc_pages(KSTACKORDER);
+}
+
+void
+kstackfree(char *v)
+{
+  if(KSTACKORDER == 0)
+    kfree(v);
+  else
+    kfree_pages(v, KSTACKORDER);
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc().  The page is freed with its last reference.
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  if(pageref[V2P(v)/PGSIZE] == 0)
+    panic("kfree: page not allocated");
+  if(__sync_sub_and_fetch(&pageref[V2P(v)/PGSIZE], 1) > 0)
+    return;
 
+  if(!kmem.use_lock){
+    freeblock(v, 0);
+    return;
+  }
+
+#ifdef JUNKFILL
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  pushcli();
+  c = &kmem.cache[cpuid()];
+  acquire(&c->lock);
+  r->next = c->freelist;
+  c->freelist = r;
+  c->nfree++;
+  c->nkfree++;
+  if(c->nfree > KCACHE_MAX)
+    drain(c, KCACHE_BATCH);
+  release(&c->lock);
+  popcli();
+}
+
+// Take a free page from this CPU's cache, the buddy lists,
+// another CPU's cache or the pre-zeroed pool, in that order.
+static struct run*
+allocpage(void)
+{
+  struct run *r;
+  struct kcache *c;
+
+  pushcli();
+  c = &kmem.cache[cpuid()];
+  acquire(&c->lock);
+  if(c->freelist == 0)
+    refill(c, KCACHE_BATCH);
+  if((r = c->freelist) != 0){
+    c->freelist = r->next;
+    c->nfree--;
+    c->nalloc++;
+    release(&c->lock);
+  } else {
+    release(&c->lock);
+    if((r = steal(c)) != 0){
+      acquire(&c->lock);
+      c->nsteal++;
+      c->nalloc++;
+      release(&c->lock);
+    }
+  }
+  popcli();
+  if(r == 0){
+    // Last resort: a page that an idle CPU already zeroed.
+    acquire(&zpool.lock);
+    if((r = zpool.freelist) != 0){
+      zpool.freelist = r->next;
+      zpool.n--;
+    }
+    release(&zpool.lock);
+  }
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -84,12 +475,189 @@ kalloc(void)
 {
   struct run *r;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock)
+    return kalloc_pages(0);
+  if((r = allocpage()) == 0 && kreclaim())
+    r = allocpage();
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    pageref[V2P(r)/PGSIZE] = 1;
   return (char*)r;
-}
\ No newline at end of file
+}
+
+// An allocation found no free memory: shrink the buffer
+// cache, which grows into free memory, and return whether
+// anything was freed so that the caller can try once more.
+// Only done when the caller holds no spinlock, because
+// bshrink() takes the buffer cache's locks and frees into
+// slab caches.
+int
+kreclaim(void)
+{
+  int nolocks;
+
+  if(!kmem.use_lock)
+    return 0;
+  pushcli();
+  nolocks = mycpu()->ncli == 1;
+  popcli();
+  return nolocks && bshrink(BSHRINK) > 0;
+}
+
+// Give every CPU's cached pages back to the buddy lists, so
+// that they can merge into larger blocks.
+static void
+drainall(void)
+{
+  struct kcache *c;
+
+  for(c = kmem.cache; c < &kmem.cache[ncpu]; c++){
+    acquire(&c->lock);
+    drain(c, c->nfree);
+    release(&c->lock);
+  }
+}
+
+// Allocate one zero-filled page, from the pre-zeroed pool
+// if possible.  Returns 0 if the memory cannot be allocated.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&zpool.lock);
+  if((r = zpool.freelist) != 0){
+    zpool.freelist = r->next;
+    zpool.n--;
+    zpool.nhit++;
+  } else
+    zpool.nmiss++;
+  release(&zpool.lock);
+
+  if(r){
+    r->next = 0;  // the only word that is not zero
+    pageref[V2P(r)/PGSIZE] = 1;
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
+  return (char*)r;
+}
+
+// Zero a few free pages into the pool.  Called by the
+// scheduler when it finds nothing to run, with no locks held.
+void
+kzero_refill(void)
+{
+  struct run *r;
+  int i;
+
+  for(i = 0; i < ZPOOL_BATCH && zpool.n < ZPOOL_MAX; i++){
+    // Only pages that are free anyway, never by shrinking
+    // the buffer cache.
+    if((r = allocpage()) == 0)
+      break;
+    memset(r, 0, PGSIZE);
+    acquire(&zpool.lock);
+    r->next = zpool.freelist;
+    zpool.freelist = r;
+    zpool.n++;
+    zpool.nzeroed++;
+    release(&zpool.lock);
+  }
+}
+
+// Turn the block of 2^order pages at v, allocated by
+// kalloc_pages(), into 2^order pages that each have one
+// reference and can be kfree()d separately.
+void
+ksplit(char *v, int order)
+{
+  int i;
+
+  for(i = 0; i < (1 << order); i++)
+    pageref[V2P(v)/PGSIZE + i] = 1;
+}
+
+// Add a reference to the kalloc()ed page pointed at by v.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+  if(__sync_fetch_and_add(&pageref[V2P(v)/PGSIZE], 1) == 0)
+    panic("kref: page not allocated");
+}
+
+// Return the number of references to the page pointed at by v.
+int
+krefcount(char *v)
+{
+  return pageref[V2P(v)/PGSIZE];
+}
+
+// Number of free pages, including those in CPU caches and
+// the pre-zeroed pool.  Taken without locks, so only an
+// estimate.
+uint
+kfreepages(void)
+{
+  uint n;
+  int i;
+
+  n = 0;
+  for(i = 0; i <= MAXORDER; i++)
+    n += kmem.nfree[i] << i;
+  for(i = 0; i < ncpu; i++)
+    n += kmem.cache[i].nfree;
+  n += zpool.n;
+  return n;
+}
+
+// Print per-CPU allocation counters, how often the buddy
+// allocator lock was needed, and the buddy free lists.
+// Returns the number of kmem.lock acquisitions.
+int
+report_kalloc_stats(void)
+{
+  struct kcache *c;
+  uint nalloc, nkfree, ncached, nfreepg, below;
+  int i, largest;
+
+  nalloc = nkfree = ncached = 0;
+  cprintf("CPU\tkalloc\tkfree\tcached\trefill\tdrain\tsteal\n");
+  for(i = 0; i < ncpu; i++){
+    c = &kmem.cache[i];
+    cprintf("%d\t%d\t%d\t%d\t%d\t%d\t%d\n", i, c->nalloc, c->nkfree,
+            c->nfree, c->nrefill, c->ndrain, c->nsteal);
+    nalloc += c->nalloc;
+    nkfree += c->nkfree;
+    ncached += c->nfree;
+  }
+  cprintf("kmem.lock: %d acquisitions (%d contended) for %d kalloc + %d kfree\n",
+          kmem.nlock, kmem.ncontended, nalloc, nkfree);
+
+  // Fragmentation: for each order, the share of free memory
+  // that sits in blocks too small to satisfy that order.
+  kmemlock();
+  nfreepg = 0;
+  largest = -1;
+  for(i = 0; i <= MAXORDER; i++){
+    nfreepg += kmem.nfree[i] << i;
+    if(kmem.nfree[i])
+      largest = i;
+  }
+  cprintf("order\tblocks\tpages\tunusable%%\n");
+  below = 0;
+  for(i = 0; i <= MAXORDER; i++){
+    cprintf("%d\t%d\t%d\t%d\n", i, kmem.nfree[i], kmem.nfree[i] << i,
+            nfreepg ? below * 100 / nfreepg : 0);
+    below += kmem.nfree[i] << i;
+  }
+  cprintf("buddy: %d free pages (+%d cached), largest block order %d, "
+          "%d splits, %d merges, %d failed\n", nfreepg, ncached, largest,
+          kmem.nsplit, kmem.nmerge, kmem.nfail);
+  kmemunlock();
+  cprintf("zero pool: %d pages, %d hits, %d misses, %d zeroed while idle\n",
+          zpool.n, zpool.nhit, zpool.nmiss, zpool.nzeroed);
+  return kmem.nlock;
+}
@@ -0,0 +1,68 @@
+// Fork-bomb style stress of the physical page allocator.
+// Several workers fork short-lived children in a loop; every
+// fork, sbrk and exit allocates and frees pages (page tables,
+// kernel stacks, user memory) on all CPUs at once.
+// Prints the elapsed ticks and the kalloc statistics, which
+// show how rarely the global kmem.lock is taken.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NWORKER   4   // concurrent forking workers
+#define NROUND   50   // children forked by each worker
+#define NPAGE    16   // pages each child grows by
+
+void
+child(void)
+{
+  char *p;
+  int i;
+
+  p = sbrk(NPAGE * 4096);
+  if(p == (char*)-1)
+    exit();
+  for(i = 0; i < NPAGE; i++)
+    p[i * 4096] = i;
+  exit();
+}
+
+void
+worker(void)
+{
+  int i, pid;
+
+  for(i = 0; i < NROUND; i++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0)
+      child();
+    wait();
+  }
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, nworker, start, lock0, lock1;
+
+  nworker = NWORKER;
+  if(argc > 1)
+    nworker = atoi(argv[1]);
+
+  printf(1, "kallocbench: %d workers x %d forks\n", nworker, NROUND);
+  lock0 = report_kalloc_stats();
+  start = uptime();
+  for(i = 0; i < nworker; i++){
+    if(fork() == 0)
+      worker();
+  }
+  for(i = 0; i < nworker; i++)
+    wait();
+  printf(1, "kallocbench: %d ticks\n", uptime() - start);
+  lock1 = report_kalloc_stats();
+  printf(1, "kallocbench: kmem.lock taken %d times during the run\n", lock1 - lock0);
+  exit();
+}
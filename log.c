@@ -18,7 +18,27 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// asks for a commit and sleeps until it is done.
+//
+// Commits are grouped: end_op() does not commit, the commit
+// thread logdaemon() does, once COMMITTICKS have passed since
+// the transaction logged its first block or as soon as a
+// commit is asked for.  Either closes the transaction to new
+// system calls until the ones inside it have finished, so
+// that it cannot be held open forever.  By default end_op()
+// asks for the commit and waits for it, so an FS system call
+// is on disk when it returns.  In asynchronous mode (see
+// logsetasync()) end_op() just returns, and a system call is
+// on disk at most about COMMITTICKS after it returns, or when
+// fsync() returns.
+//
+// Committed transactions are not installed at once: they stay
+// in the log, with their blocks pinned dirty in the cache, and
+// the next transaction is appended after them.  The commit
+// thread installs them all together when the log runs short of
+// space, INSTALLTICKS after the first of them committed, or
+// when reclaim() needs the cache memory back, so that a block
+// changed by many transactions is written home once.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -27,7 +47,8 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous.  A block may be in the log more
+// than once, from different transactions; the last copy wins.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -39,44 +60,85 @@ struct logheader {
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // data blocks in the log, at most LOGSIZE
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int commitreq;   // commit wanted; no new FS sys calls until then
+  int installreq;  // install wanted after the commit
+  int committed;   // lh.block[0..committed) are committed, not installed
+  uint opened;     // ticks when the transaction logged its first block
+  uint oldest;     // ticks when lh.block[0] was committed
+  int async;       // end_op() does not wait for the commit
   int dev;
   struct logheader lh;
+
+  // Statistics.
+  uint nop;        // FS system calls
+  uint nabsorb;    // log_write()s of a block already in the transaction
+  uint ncommit;    // commits, including empty ones
+  uint nlogged;    // blocks written to the log
+  uint nfsync;     // commits asked for by fsync()
+  uint ninstall;   // installs
+  uint ninstalled; // blocks written home
+  uint nfull;      // installs because the log was short of space
+  uint npressure;  // installs asked for by reclaim()
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void install(void);
+static void logdaemon(void);
+static void waitcommit(int);
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) >= MINBSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
   readsb(dev, &sb);
   log.start = sb.logstart;
-  log.size = sb.nlog;
+  log.size = sb.nlog - 1;  // the first block is the header
+  if (log.size > LOGSIZE)
+    log.size = LOGSIZE;
+  if (log.size < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
   recover_from_log();
+  kthread("logd", logdaemon);
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks to their home location.  Only the last
+// copy of a block is installed.  The cache still holds each
+// block as committed, pinned by B_DIRTY since log_write(), and
+// it is written from there; only recovery reads the log.
 static void
-install_trans(void)
+install_trans(int recovering)
 {
-  int tail;
+  int tail, i;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+    for (i = tail+1; i < log.lh.n; i++)
+      if (log.lh.block[i] == log.lh.block[tail])
+        break;
+    if (i < log.lh.n)
+      continue;
+    log.ninstalled++;
+    struct buf *dbuf;
+    if (recovering) {
+      dbuf = bnew(log.dev, log.lh.block[tail]);  // dst, overwritten
+      struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+      memmove(dbuf->data, lbuf->data, bsize);  // copy block to dst
+      brelse(lbuf);
+    } else {
+      dbuf = bread(log.dev, log.lh.block[tail]);  // cached dst
+      if ((dbuf->flags & B_DIRTY) == 0)
+        panic("install_trans: not pinned");
+    }
     bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
     brelse(dbuf);
   }
 }
@@ -116,7 +178,7 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
+  install_trans(1); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
 }
@@ -127,13 +189,20 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.commitreq){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.size){
       // this op might exhaust log space; wait for commit.
+      log.commitreq = 1;
+      if(log.committed > 0){
+        log.installreq = 1;
+        log.nfull++;
+      }
+      wakeup(&log.commitreq);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.nop++;
       release(&log.lock);
       break;
     }
@@ -141,48 +210,80 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// lets the commit thread in if this was the last outstanding
+// operation of a transaction that is waiting to commit, and
+// unless the log is asynchronous waits for the commit.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  int async;
 
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  if(log.outstanding == 0 && log.commitreq)
+    wakeup(&log.commitreq);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
+  async = log.async;
   release(&log.lock);
+  if(!async)
+    waitcommit(0);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// The commit thread.  Waits for the running transaction to be
+// due, for its system calls to finish, and commits it; then
+// installs the committed transactions if that is due too.
+static void
+logdaemon(void)
+{
+  int doinstall;
+
+  acquire(&log.lock);
+  for(;;){
+    if(log.lh.n > log.committed && ticks - log.opened >= COMMITTICKS)
+      log.commitreq = 1;
+    if(log.committed > 0 && ticks - log.oldest >= INSTALLTICKS)
+      log.installreq = 1;
+    if(log.installreq)
+      log.commitreq = 1;  // install only with no transaction open
+    if(log.commitreq && log.outstanding == 0){
+      doinstall = log.installreq;
+      log.committing = 1;
+      log.commitreq = 0;
+      log.installreq = 0;
+      // call commit w/o holding locks, since not allowed
+      // to sleep with locks.
+      release(&log.lock);
+      commit();
+      if(doinstall)
+        install();
+      acquire(&log.lock);
+      log.committing = 0;
+      log.ncommit++;
+      wakeup(&log);
+    } else if(log.lh.n > 0 && !log.commitreq){
+      // check the timer again on the next tick.
+      sleep(&ticks, &log.lock);
+    } else {
+      sleep(&log.commitreq, &log.lock);
+    }
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy blocks modified since the last commit from cache to log.
 static void
 write_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+  for (tail = log.committed; tail < log.lh.n; tail++) {
+    struct buf *to = bnew(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
+    memmove(to->data, from->data, bsize);
     bwrite(to);  // write the log
     brelse(from);
     brelse(to);
@@ -192,13 +293,106 @@ write_log(void)
 static void
 commit()
 {
-  if (log.lh.n > 0) {
+  if (log.lh.n > log.committed) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+    if (log.committed == 0)
+      log.oldest = ticks;
+    log.nlogged += log.lh.n - log.committed;
+    log.committed = log.lh.n;
+  }
+}
+
+// Install the committed transactions and empty the log.
+// Called with no transaction open, so the cached blocks
+// hold what was committed.
+static void
+install(void)
+{
+  if (log.committed > 0) {
+    install_trans(0); // Now install writes to home locations
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.committed = 0;
+    write_head();    // Erase the transactions from the log
+    log.ninstall++;
+  }
+}
+
+// Wait until every FS system call that has returned is on
+// disk.  The caller must not be inside a transaction.
+// fsync says whether fsync() asked.
+static void
+waitcommit(int fsync)
+{
+  uint target;
+
+  acquire(&log.lock);
+  if(log.committing || log.lh.n > log.committed){
+    // The commit under way, or else the next one, holds every
+    // system call that has finished.
+    target = log.ncommit + 1;
+    if(!log.committing){
+      log.commitreq = 1;
+      if(fsync)
+        log.nfsync++;
+      wakeup(&log.commitreq);
+    }
+    while((int)(log.ncommit - target) < 0)
+      sleep(&log, &log.lock);
   }
+  release(&log.lock);
+}
+
+void
+logsync(void)
+{
+  waitcommit(1);
+}
+
+// Turn asynchronous commits on or off.  Returns whether they
+// were on.
+int
+logsetasync(int on)
+{
+  int old;
+
+  acquire(&log.lock);
+  old = log.async;
+  log.async = (on != 0);
+  release(&log.lock);
+  return old;
+}
+
+// Ask the commit thread to install the committed transactions,
+// so that their cached blocks can be freed.  Does not wait.
+void
+loginstall(void)
+{
+  acquire(&log.lock);
+  if(log.committed > 0 && !log.installreq){
+    log.installreq = 1;
+    log.npressure++;
+    wakeup(&log.commitreq);
+  }
+  release(&log.lock);
+}
+
+void
+report_log_stats(void)
+{
+  int ndirty;
+
+  ndirty = bdirty();
+  acquire(&log.lock);
+  cprintf("log: %s commits, %d/%d blocks, %d committed and not installed\n",
+          log.async ? "asynchronous" : "synchronous", log.lh.n, log.size,
+          log.committed);
+  cprintf("log: %d dirty buffers pinned in the cache\n", ndirty);
+  cprintf("log: %d ops, %d absorbed writes, %d commits of %d blocks, %d for fsync\n",
+          log.nop, log.nabsorb, log.ncommit, log.nlogged, log.nfsync);
+  cprintf("log: %d installs of %d blocks, %d for space, %d for memory\n",
+          log.ninstall, log.ninstalled, log.nfull, log.npressure);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -215,19 +409,27 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
+  for (i = log.committed; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i < log.lh.n)
+    log.nabsorb++;
+  if (i == log.lh.n){
+    if (log.lh.n == log.committed){
+      // a new transaction; start the commit timer.
+      log.opened = ticks;
+      wakeup(&log.commitreq);
+    }
     log.lh.n++;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
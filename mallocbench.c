@@ -0,0 +1,161 @@
+// Compare malloc() with the first-fit Kernighan and Ritchie
+// allocator it replaced, on alloc/free churn.  NSLOT blocks are
+// kept live; each step frees a random one and allocates a new
+// block of a random, mostly small size in its place.  Each
+// allocator runs in its own child so that the heaps do not mix.
+// Prints the elapsed ticks and how far each one grew the heap.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NSLOT   512
+#define NSTEP   200000
+
+// The old allocator, from The C Programming Language,
+// 2nd ed., Section 8.7.
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header base;
+static Header *freep;
+
+void
+kr_free(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  freep = p;
+}
+
+static Header*
+morecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  kr_free((void*)(hp + 1));
+  return freep;
+}
+
+void*
+kr_malloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = freep) == 0){
+    base.s.ptr = freep = prevp = &base;
+    base.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      freep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == freep)
+      if((p = morecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+static uint seed = 1;
+
+static uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+// Mostly small blocks, with an occasional large one.
+static uint
+randsize(void)
+{
+  uint r;
+
+  r = rand();
+  if(r % 64 == 0)
+    return 4096 + r % 8192;
+  if(r % 8 == 0)
+    return 256 + r % 1024;
+  return 8 + r % 120;
+}
+
+void
+run(char *name, void *(*alloc)(uint), void (*release)(void*))
+{
+  static char *slot[NSLOT];
+  char *brk;
+  uint i, j, t;
+
+  brk = sbrk(0);
+  t = uptime();
+  for(i = 0; i < NSTEP; i++){
+    j = rand() % NSLOT;
+    if(slot[j])
+      release(slot[j]);
+    if((slot[j] = alloc(randsize())) == 0){
+      printf(1, "mallocbench: %s: out of memory\n", name);
+      exit();
+    }
+    slot[j][0] = 1;
+  }
+  for(j = 0; j < NSLOT; j++)
+    if(slot[j])
+      release(slot[j]);
+  printf(1, "mallocbench: %s: %d steps in %d ticks, heap grew %d KB\n",
+         name, NSTEP, uptime() - t, (sbrk(0) - brk) / 1024);
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(fork() == 0)
+    run("K&R first-fit", kr_malloc, kr_free);
+  wait();
+  if(fork() == 0)
+    run("size classes", malloc, free);
+  wait();
+  exit();
+}
@@ -15,14 +15,14 @@
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
-static int disksize;
+static uint disksize;  // bytes
 static uchar *memdisk;
 
 void
 ideinit(void)
 {
   memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  disksize = (uint)_binary_fs_img_size;
 }
 
 // Interrupt handler.
@@ -46,15 +46,35 @@ iderw(struct buf *b)
     panic("iderw: nothing to do");
   if(b->dev != 1)
     panic("iderw: request not for disk 1");
-  if(b->blockno >= disksize)
+  if(b->blockno >= disksize/bsize)
     panic("iderw: block out of range");
 
-  p = memdisk + b->blockno*BSIZE;
+  p = memdisk + b->blockno*bsize;
 
   if(b->flags & B_DIRTY){
     b->flags &= ~B_DIRTY;
-    memmove(p, b->data, BSIZE);
+    memmove(p, b->data, bsize);
   } else
-    memmove(b->data, p, BSIZE);
+    memmove(b->data, p, bsize);
   b->flags |= B_VALID;
 }
+
+// There are no interrupts; read b at once and release it.
+void
+iderwasync(struct buf *b)
+{
+  iderw(b);
+  bdone(b);
+}
+
+int
+idesetdma(int on)
+{
+  return -1;
+}
+
+void
+report_ide_stats(void)
+{
+  cprintf("ide: memory disk\n");
+}
@@ -1,16 +1,27 @@
 #define NPROC        64  // maximum number of processes
-#define KSTACKSIZE 4096  // size of per-process kernel stack
+#define KSTACKORDER   0  // log2 of pages per kernel stack
+#define KSTACKSIZE (4096<<KSTACKORDER)  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  20  // max # of blocks any FS op writes
+#define LOGSIZE      (MAXOPBLOCKS*6) // max data blocks in on-disk log
+#define COMMITTICKS   5  // longest a transaction stays open, in ticks
+#define INSTALLTICKS 100  // longest a commit waits to be installed, in ticks
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // disk block cache buffers always present
+#define BCACHEFRAC   8  // buffer cache may grow to 1/BCACHEFRAC of RAM
+#define BCACHEFREE 1024  // ... while more pages than this are free
+#define BSHRINK      32  // buffers freed per reclaim()
+#define RAMIN         4  // first read-ahead window, in blocks
+#define RAMAX        32  // largest read-ahead window, in blocks
+#define FSSIZE      20000  // size of file system in blocks
+#define SWAPPAGES   16384  // size of swap disk in pages (64MB)
 #define _NQUEUE       3  // Number of queues in MLFQ scheduling algorithm
 #define MAX_WAIT_TIME 800
-#define _NSHAREDPAGES 10
\ No newline at end of file
+#define NVMA         16  // shared memory and mmap() mappings per process
+#define NEXECSEG      4  // loadable program segments per executable
+#define NTEXTPAGES  1024  // program text pages shared between processes
+#define MAXORDER     10  // largest buddy block is 2^MAXORDER pages (4MB)
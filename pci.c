@@ -0,0 +1,62 @@
+// PCI configuration space, through configuration mechanism #1:
+// write the address of a register to CONFADDR, then read or
+// write it at CONFDATA.  Only bus 0 is searched, which is where
+// QEMU's PC puts its devices.
+// http://wiki.osdev.org/PCI
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+
+#define CONFADDR   0xCF8
+#define CONFDATA   0xCFC
+
+#define REG_ID     0x00  // vendor ID, device ID
+#define REG_CMD    0x04  // command and status
+#define REG_CLASS  0x08  // revision, prog if, subclass, class
+#define REG_HDR    0x0C  // header type in bits 16-23
+
+#define HDR_MULTI  0x00800000  // device has functions 1-7
+
+static uint
+confaddr(int dev, int func, int reg)
+{
+  return 0x80000000 | (dev << 11) | (func << 8) | (reg & 0xFC);
+}
+
+uint
+pciread(int dev, int func, int reg)
+{
+  outl(CONFADDR, confaddr(dev, func, reg));
+  return inl(CONFDATA);
+}
+
+void
+pciwrite(int dev, int func, int reg, uint v)
+{
+  outl(CONFADDR, confaddr(dev, func, reg));
+  outl(CONFDATA, v);
+}
+
+// Find the first function of class and subclass on bus 0.
+// Returns its dev<<3|func, or -1 if there is none.
+int
+pcifind(int class, int subclass)
+{
+  int dev, func, nfunc;
+  uint c;
+
+  for(dev = 0; dev < 32; dev++){
+    if((pciread(dev, 0, REG_ID) & 0xFFFF) == 0xFFFF)
+      continue;
+    nfunc = (pciread(dev, 0, REG_HDR) & HDR_MULTI) ? 8 : 1;
+    for(func = 0; func < nfunc; func++){
+      if((pciread(dev, func, REG_ID) & 0xFFFF) == 0xFFFF)
+        continue;
+      c = pciread(dev, func, REG_CLASS);
+      if((c >> 24) == class && ((c >> 16) & 0xFF) == subclass)
+        return dev << 3 | func;
+    }
+  }
+  return -1;
+}
@@ -114,7 +114,7 @@ found:
   release(&ptable.lock);
 
   // Allocate kernel stack.
-  if ((p->kstack = kalloc()) == 0)
+  if ((p->kstack = kstackalloc()) == 0)
   {
     p->state = UNUSED;
     return 0;
@@ -144,6 +144,8 @@ found:
   p->burst_time=2;
   p->consecutive_runs=0;
   p->arrival=ticks;
+  p->superpages=1;
+  p->readahead=RAMAX;
   return p;
 }
 
@@ -184,7 +186,28 @@ void userinit(void)
   release(&ptable.lock);
 }
 
+// Start a kernel thread called name that runs fn(), which must
+// never return.  The thread has no user memory, files or parent;
+// forkret() returns into fn instead of trapret.
+void kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    panic("kthread");
+  if ((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory");
+  *(uint *)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+}
+
 // Grow current process's memory by n bytes.
+// Growing only reserves address space; pagefault() maps a
+// zeroed page the first time each new page is touched.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
@@ -194,16 +217,17 @@ int growproc(int n)
   sz = curproc->sz;
   if (n > 0)
   {
-    if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if (sz + n < sz || sz + n > vmabase(curproc))
       return -1;
+    sz += n;
   }
   else if (n < 0)
   {
     if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
+    tlbflush(curproc->pgdir, sz, -n);
   }
   curproc->sz = sz;
-  switchuvm(curproc);
   return 0;
 }
 
@@ -224,12 +248,32 @@ int fork(void)
   // Copy process state from proc.
   if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0)
   {
-    kfree(np->kstack);
+    kstackfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  // copyuvm() and copyvmas() make the parent's writable
+  // pages copy-on-write.
+  i = copyvmas(np, curproc);
+  tlbflush(curproc->pgdir, 0, KERNBASE);
+  if (i < 0)
+  {
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    kstackfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
   np->sz = curproc->sz;
+  np->superpages = curproc->superpages;
+  np->readahead = curproc->readahead;
+  if (curproc->exe) {
+    np->exe = idup(curproc->exe);
+    textref(np->exe);
+  }
+  memmove(np->segs, curproc->segs, sizeof(np->segs));
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -277,10 +321,17 @@ void exit(void)
     }
   }
 
+  freevmas(curproc);
+  if (curproc->exe)
+    textunref(curproc->exe);
+
   begin_op();
   iput(curproc->cwd);
+  if (curproc->exe)
+    iput(curproc->exe);
   end_op();
   curproc->cwd = 0;
+  curproc->exe = 0;
 
   acquire(&ptable.lock);
 
@@ -326,7 +377,7 @@ int wait(void)
       {
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
+        kstackfree(p->kstack);
         p->kstack = 0;
         freevm(p->pgdir);
         p->pid = 0;
@@ -454,7 +505,7 @@ int _FCFS_scheduler(){
 //       via swtch back to the scheduler.
 void scheduler(void)
 {
-  int p_index;
+  int p_index, ran;
   struct proc *p;
   struct cpu *c = mycpu();
   c->proc = 0;
@@ -463,6 +514,7 @@ void scheduler(void)
     // Enable interrupts on this processor.
     sti();
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     do
     {
@@ -496,6 +548,7 @@ void scheduler(void)
       c->proc = p;
       switchuvm(p);
       p->state = RUNNING;
+      ran = 1;
       swtch(&(c->scheduler), p->context);
       switchkvm();
 
@@ -504,6 +557,10 @@ void scheduler(void)
       c->proc = 0;
     }while (c->_consecutive_runs_queue || c->_current_queue!=_NQUEUE-1);
     release(&ptable.lock);
+
+    // Nothing to run: prepare zeroed pages for later page faults.
+    if(!ran)
+      kzero_refill();
   }
 }
 // Enter scheduler.  Must hold only ptable.lock
@@ -903,6 +960,93 @@ int report_all_processes(void)
   release(&ptable.lock);
   return 0;
 }
+// Print how many pages of address space each process has
+// reserved (below p->sz) and how many are resident.
+int report_memory_usage(void)
+{
+  struct proc *p;
+  int reserved, resident, total;
+
+  total = 0;
+  acquire(&ptable.lock);
+  cprintf("Name\tPid\tReserved\tResident\tSuperpages\n");
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  {
+    if (p->state == UNUSED || p->state == EMBRYO || p->state == ZOMBIE)
+      continue;
+    reserved = PGROUNDUP(p->sz) / PGSIZE;
+    resident = residentpages(p->pgdir, p->sz);
+    total += resident;
+    cprintf("%s\t%d\t%d\t\t%d\t\t%d\n", p->name, p->pid, reserved, resident,
+            superpages(p->pgdir));
+  }
+  release(&ptable.lock);
+  report_superpage_stats();
+  report_text_stats();
+  report_swap_stats();
+  return total;
+}
+
+// Free a page of memory, by shrinking the buffer cache or
+// else by writing a user page out to swap.
+// Victims are chosen with the clock (second-chance)
+// algorithm, sweeping over every process's pages in turn;
+// running processes other than the caller are skipped, since
+// their TLBs may hold the PTE.  Must be called in process
+// context without spinlocks held, because it sleeps.
+// Returns -1 if there was nothing to swap out.
+int reclaim(void)
+{
+  static int hand;    // clock hand: process and address
+  static uint handva;
+  struct proc *p, *curproc = myproc();
+  char *page;
+  int i, slot, found, scanself;
+  uint nscan;
+
+  // Cached disk blocks are cheaper to lose than user pages.
+  if (bshrink(BSHRINK) > 0)
+    return 0;
+  // Blocks pinned by the log can go once they are installed.
+  loginstall();
+  if ((slot = swapalloc()) < 0)
+    return -1;
+  found = scanself = 0;
+  nscan = 0;
+  acquire(&ptable.lock);
+  // Two sweeps over all processes clear every accessed bit
+  // on the first, so the second finds a victim if any.
+  for (i = 0; i <= 2 * NPROC && !found; i++)
+  {
+    p = &ptable.proc[hand];
+    if (p->pgdir && (p->state == SLEEPING || p->state == RUNNABLE ||
+                     p == curproc))
+    {
+      scanself |= (p == curproc);
+      found = clockscan(p->pgdir, p->sz, &handva, slot, &page, &nscan);
+    }
+    if (!found)
+    {
+      hand = (hand + 1) % NPROC;
+      handva = 0;
+    }
+  }
+  // No other CPU runs curproc, so a local flush is enough
+  // (tlbflush() must not be used with ptable.lock held).
+  if (scanself)
+    lcr3(V2P(curproc->pgdir));
+  release(&ptable.lock);
+
+  swapscanned(nscan, found);
+  if (!found)
+  {
+    swapcancel(slot);
+    return -1;
+  }
+  swapout(slot, page);
+  return 0;
+}
+
 static struct fib_numbers
 {
   struct reentrantlock lock;
@@ -948,7 +1092,7 @@ void _factorial_init()
 void calculate_factorial(int n, int id)
 {
   int last = 0;
-  int *mem = (int*)open_sharedmem(id);
+  int *mem = (int*)open_sharedmem(id, 0);
   if ((int)mem == -1)
   {
     cprintf("ERROR: open_sharedmem failed for process %d\n",myproc()->pid);
@@ -11,6 +11,7 @@ struct cpu {
   int _consecutive_runs_queue; // The number of times a process from the last queue has been running.
   int _current_queue;          // The current queue the cpu is choosing processes from.
   int _syscall_counter;        // Number of system calls, called by a process being run on this CPU
+  volatile int tlbpending;     // TLB shootdown request not yet handled
 };
 
 extern struct cpu cpus[NCPU];
@@ -39,11 +40,34 @@ struct context {
   uint eip;
 };
 
+// A region of the user address space above the heap that
+// maps a shared memory segment, a file, or anonymous memory.
+// Unused if end is 0.
+struct vma {
+  uint start;            // first address, page-aligned
+  uint end;              // one past the last address
+  int prot;              // PROT_READ, PROT_WRITE
+  int nopen;             // open_sharedmem() calls not yet closed
+  struct shmseg *shm;    // the mapped segment, or
+  struct file *f;        // the mapped file, or neither if anonymous
+  uint off;              // file offset of start
+};
+
+// A loadable segment of the running executable.  Its pages
+// are read from the file on first touch.  Pages of read-only
+// segments are shared by every process running the file.
+struct execseg {
+  uint va;               // first address, page-aligned
+  uint filesz;           // bytes backed by the file; zero after that
+  uint off;              // file offset of va
+  int writable;          // segment has ELF_PROG_FLAG_WRITE
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 static const char *syscall_names[] = {"fork", "exit", "wait", "pipe", "read", "kill", "exec", "fstat", "chdir", "dup", "getpid", "sbrk", "sleep","uptime", "open",
  "write", "mknod", "unlink", "link", "mkdir", "close", "create_palindrome", "move_file", "sort_syscalls", "get_most_invoked_syscall", "list_all_processes", 
- "set_sjf_info", "set_queue", "report_all_processes", "total_syscalls_count", "fibonacci_number", "open_sharedmem", "close_sharedmem","calculate_factorial"};
+ "set_sjf_info", "set_queue", "report_all_processes", "total_syscalls_count", "fibonacci_number", "open_sharedmem", "close_sharedmem","calculate_factorial","report_kalloc_stats","report_memory_usage","set_superpages","mmap","munmap","report_bcache_stats","set_readahead","drop_bcache","fsync","report_log_stats","set_logasync","set_idedma","report_disk_stats"};
 
 // Per-process state
 struct proc {
@@ -59,6 +83,9 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vmas[NVMA];       // Shared memory and mmap() mappings
+  struct inode *exe;           // Executable, pinned while pages load from it
+  struct execseg segs[NEXECSEG]; // Segments of exe; unused if filesz is 0
   char name[16];               // Process name (debugging)
   int sc[sizeof(syscall_names) / sizeof(char *)]; // Babak          // Array storing the number of times each system call is invoked by this process
   int queue;             // The scheduling queue
@@ -67,6 +94,8 @@ struct proc {
   int burst_time;        // Burst time
   int consecutive_runs;  // Last number of consecutive runs
   int arrival;           // Time of arrival
+  int superpages;        // If non-zero, back large heap regions with 4MB pages
+  int readahead;         // Largest read-ahead window in blocks; 0 turns it off
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,75 @@
+// Measure sequential file reads from a cold buffer cache, with
+// read-ahead off and on.  Writes a file that fills the direct
+// and single-indirect blocks of an inode with 512-byte blocks,
+// then reads it NPASS times the way cat does, 512 bytes per
+// read(), dropping the cached blocks before each pass.
+// Prints the elapsed ticks of each mode.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define NPASS 20
+
+char buf[MINBSIZE];
+
+void
+run(int ra, int size)
+{
+  int fd, pass, n, total;
+  uint t;
+
+  set_readahead(ra);
+  t = uptime();
+  for(pass = 0; pass < NPASS; pass++){
+    if((fd = open("readbench.tmp", O_RDONLY)) < 0){
+      printf(1, "readbench: cannot open readbench.tmp\n");
+      exit();
+    }
+    drop_bcache(fd);
+    total = 0;
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      total += n;
+    close(fd);
+    if(total != size){
+      printf(1, "readbench: read %d bytes, expected %d\n", total, size);
+      exit();
+    }
+  }
+  printf(1, "readbench: read-ahead %d blocks: %d passes of %d KB in %d ticks\n",
+         ra, NPASS, size / 1024, uptime() - t);
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, size;
+
+  size = (NDIRECT + NINDIRECT(MINBSIZE)) * MINBSIZE;
+  fd = open("readbench.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "readbench: cannot create readbench.tmp\n");
+    exit();
+  }
+  for(i = 0; i < size; i += sizeof(buf)){
+    memset(buf, i / sizeof(buf), sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "readbench: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  if(fork() == 0)
+    run(0, size);
+  wait();
+  if(fork() == 0)
+    run(32, size);
+  wait();
+  unlink("readbench.tmp");
+  report_bcache_stats();
+  exit();
+}
@@ -0,0 +1,264 @@
+// Slab allocator for fixed-size kernel objects.
+//
+// A cache hands out objects of one size.  Objects are carved
+// out of slabs, each a naturally aligned block of 2^order
+// pages with a struct slab header at its start; free objects
+// in a slab are chained through their first word.  Small
+// objects use one-page slabs, but a cache of large objects
+// takes bigger slabs when one page would waste more than an
+// eighth of itself, so that e.g. 2K objects do not fit one
+// per page.  A slab whose objects are all free
+// goes back to kalloc(), so memory follows demand.
+//
+// Each CPU keeps a few free objects of every cache so that
+// most allocations and frees do not take the cache lock.
+//
+// Interface:
+// * kmem_cache_create(name, size) makes a cache; there is no destroy.
+// * kmem_cache_alloc(c) returns an object, or 0 if out of memory.
+//   The contents are undefined.
+// * kmem_cache_free(c, obj) returns an object to its cache.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+
+#define NKMEMCACHE 16  // maximum number of object caches
+#define NCPUOBJ     8  // objects held in each per-CPU cache
+#define SLABMAXORDER 2  // largest slab is 2^SLABMAXORDER pages
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;   // in cache->partial or cache->full
+  struct slab *prev;
+  uint inuse;          // allocated objects in this slab
+  void *freelist;      // free objects in this slab
+};
+
+struct cpuobjs {
+  int n;
+  void *obj[NCPUOBJ];
+};
+
+struct kmem_cache {
+  struct spinlock lock;
+  char *name;
+  uint size;            // object size, rounded up to 4 bytes
+  uint perslab;         // objects per slab
+  int order;            // slabs are 2^order pages
+  struct slab *partial; // slabs with at least one free object
+  struct slab *full;    // slabs with no free objects
+  uint nslab;           // slabs currently allocated
+  uint nactive;         // objects handed out (including CPU caches)
+  struct cpuobjs cpu[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  int n;
+  struct kmem_cache cache[NKMEMCACHE];
+} kmem_caches;
+
+void
+slabinit(void)
+{
+  initlock(&kmem_caches.lock, "kmem_caches");
+}
+
+// Create a cache for objects of size bytes.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 3) & ~3;
+  if(size < sizeof(void*) || size > PGSIZE - sizeof(struct slab))
+    panic("kmem_cache_create: bad size");
+
+  acquire(&kmem_caches.lock);
+  if(kmem_caches.n >= NKMEMCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &kmem_caches.cache[kmem_caches.n++];
+  release(&kmem_caches.lock);
+
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  while(c->order < SLABMAXORDER &&
+        ((PGSIZE << c->order) - sizeof(struct slab)) % size >
+        (PGSIZE << c->order) / 8)
+    c->order++;
+  c->perslab = ((PGSIZE << c->order) - sizeof(struct slab)) / size;
+  return c;
+}
+
+static void
+slabpush(struct slab **list, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *list;
+  if(*list)
+    (*list)->prev = s;
+  *list = s;
+}
+
+static void
+slabremove(struct slab **list, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Allocate a fresh slab for c and put it on c->partial.
+// Caller holds c->lock.
+static struct slab*
+slabgrow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if(c->order == 0)
+    s = (struct slab*)kalloc();
+  else
+    s = (struct slab*)kalloc_pages(c->order);
+  if(s == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  obj = (char*)(s + 1) + (c->perslab - 1) * c->size;
+  for(i = 0; i < c->perslab; i++, obj -= c->size){
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+  }
+  slabpush(&c->partial, s);
+  c->nslab++;
+  return s;
+}
+
+// Take one object from the slabs of c.  Caller holds c->lock.
+static void*
+slaballoc(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+    return 0;
+  obj = s->freelist;
+  s->freelist = *(void**)obj;
+  if(++s->inuse == c->perslab){
+    slabremove(&c->partial, s);
+    slabpush(&c->full, s);
+  }
+  c->nactive++;
+  return obj;
+}
+
+// Return obj to its slab.  Caller holds c->lock.
+static void
+slabfree(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)((uint)obj & ~((PGSIZE << c->order) - 1));
+  if(s->cache != c)
+    panic("kmem_cache_free: wrong cache");
+  if(s->inuse-- == c->perslab){
+    slabremove(&c->full, s);
+    slabpush(&c->partial, s);
+  }
+  *(void**)obj = s->freelist;
+  s->freelist = obj;
+  c->nactive--;
+
+  // Give the page back, but keep one slab around so that
+  // alloc/free of a single object does not thrash kalloc.
+  if(s->inuse == 0 && (s->next || s->prev)){
+    slabremove(&c->partial, s);
+    c->nslab--;
+    if(c->order == 0)
+      kfree((char*)s);
+    else
+      kfree_pages((char*)s, c->order);
+  }
+}
+
+// Take an object from this CPU's cache of c, refilling it
+// from the slabs if it is empty.
+static void*
+cachealloc(struct kmem_cache *c)
+{
+  struct cpuobjs *co;
+  void *obj;
+
+  pushcli();
+  co = &c->cpu[cpuid()];
+  if(co->n == 0){
+    // Refill half of the CPU cache in one go.
+    acquire(&c->lock);
+    while(co->n < NCPUOBJ/2 && (obj = slaballoc(c)) != 0)
+      co->obj[co->n++] = obj;
+    release(&c->lock);
+  }
+  obj = co->n > 0 ? co->obj[--co->n] : 0;
+  popcli();
+  return obj;
+}
+
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  void *obj;
+
+  // slabgrow() calls kalloc() with c->lock held, where it
+  // cannot reclaim memory, so try again from here.
+  if((obj = cachealloc(c)) == 0 && kreclaim())
+    obj = cachealloc(c);
+  return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct cpuobjs *co;
+
+  pushcli();
+  co = &c->cpu[cpuid()];
+  if(co->n == NCPUOBJ){
+    // Flush half of the CPU cache back to the slabs.
+    acquire(&c->lock);
+    while(co->n > NCPUOBJ/2)
+      slabfree(c, co->obj[--co->n]);
+    release(&c->lock);
+  }
+  co->obj[co->n++] = obj;
+  popcli();
+}
+
+// Print the object caches: object size, objects per slab,
+// pages in slabs and objects handed out.
+void
+report_slab_stats(void)
+{
+  struct kmem_cache *c;
+  int i;
+
+  cprintf("cache\t\tsize\tperslab\tpages\tactive\n");
+  for(i = 0; i < kmem_caches.n; i++){
+    c = &kmem_caches.cache[i];
+    cprintf("%s\t\t%d\t%d\t%d\t%d\n", c->name, c->size, c->perslab,
+            c->nslab << c->order, c->nactive);
+  }
+}
@@ -0,0 +1,42 @@
+// Measure the cost of creating and destroying a process:
+// fork, exec of a program that exits at once, exit and wait,
+// repeated NSPAWN times (or argv[1] times).
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NSPAWN 500
+
+char *childargv[] = { "spawnbench", "-c", 0 };
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, pid, start, ticks;
+
+  if(argc > 1 && strcmp(argv[1], "-c") == 0)
+    exit();
+  n = NSPAWN;
+  if(argc > 1)
+    n = atoi(argv[1]);
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "spawnbench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec("spawnbench", childargv);
+      printf(1, "spawnbench: exec failed\n");
+      exit();
+    }
+    wait();
+  }
+  ticks = uptime() - start;
+  printf(1, "spawnbench: %d fork+exec+exit in %d ticks (%d per 100)\n",
+         n, ticks, ticks * 100 / n);
+  exit();
+}
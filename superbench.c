@@ -0,0 +1,62 @@
+// Compare a large heap backed by 4KB pages with the same heap
+// backed by 4MB superpages.  Each run grows the heap by NMB
+// megabytes, touches every page once (populate), then walks it
+// NPASS times one word per page, which is the access pattern
+// that misses the TLB most with 4KB pages.
+// Prints the elapsed ticks of each phase and the superpage
+// counters from report_memory_usage().
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NMB     16    // heap size in megabytes
+#define NPASS   200   // page-stride passes over the heap
+#define SUPER   (4*1024*1024)
+
+void
+run(int super)
+{
+  char *p;
+  uint i, n, pass, sum, t0, t1, t2;
+
+  set_superpages(super);
+  // Start the region on a 4MB boundary so that every 4MB of
+  // it can be a superpage.
+  p = sbrk(0);
+  if((uint)p % SUPER)
+    sbrk(SUPER - (uint)p % SUPER);
+  n = NMB * 1024 * 1024;
+  if((p = sbrk(n)) == (char*)-1){
+    printf(1, "superbench: sbrk failed\n");
+    exit();
+  }
+
+  t0 = uptime();
+  for(i = 0; i < n; i += 4096)
+    p[i] = 1;
+  t1 = uptime();
+  sum = 0;
+  for(pass = 0; pass < NPASS; pass++)
+    for(i = 0; i < n; i += 4096)
+      sum += p[i];
+  t2 = uptime();
+
+  printf(1, "superbench: %s: populate %d ticks, %d passes %d ticks (sum %d)\n",
+         super ? "4MB pages" : "4KB pages", t1 - t0, NPASS, t2 - t1, sum);
+  report_memory_usage();
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf(1, "superbench: %d MB heap\n", NMB);
+  if(fork() == 0)
+    run(0);
+  wait();
+  if(fork() == 0)
+    run(1);
+  wait();
+  exit();
+}
@@ -0,0 +1,146 @@
+// Swap space for user pages.
+//
+// The swap disk (the master drive of the secondary IDE
+// channel) is divided into SWAPPAGES page-sized slots.
+// reclaim() in proc.c picks a victim page with the clock
+// algorithm and calls swapout(); a page-table entry for a
+// swapped-out page is not present and holds the slot number
+// and PTE_SWAP.  The page-fault handler calls swapin().
+//
+// Each slot has a reference count, the number of page-table
+// entries that refer to it (fork copies swapped-out entries),
+// and a busy flag that is set while the page is being
+// written.  A slot is free when both are zero.  The counts
+// are changed with atomic operations, so that freevm() can
+// drop them while holding ptable.lock; swap.lock is only
+// taken to allocate a slot and to wait for a busy one.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+static struct {
+  struct spinlock lock;
+  uchar ref[SWAPPAGES];   // page-table entries referring to slot
+  uchar busy[SWAPPAGES];  // slot is being written
+  uint npageout;
+  uint npagein;
+  uint nreclaim;          // calls to reclaim()
+  uint nscan;             // PTEs examined by the clock
+  uint nfail;             // reclaims that found no victim
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+}
+
+// Allocate a slot for a page about to be written.  The slot
+// is returned busy with one reference.  Returns -1 if there
+// is no swap disk or it is full.
+int
+swapalloc(void)
+{
+  int i;
+
+  if(!ideswappresent())
+    return -1;
+  acquire(&swap.lock);
+  for(i = 0; i < SWAPPAGES; i++){
+    if(swap.ref[i] == 0 && swap.busy[i] == 0){
+      swap.ref[i] = 1;
+      swap.busy[i] = 1;
+      release(&swap.lock);
+      return i;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Give back a slot from swapalloc() that was not used.
+void
+swapcancel(int slot)
+{
+  acquire(&swap.lock);
+  swap.ref[slot] = 0;
+  swap.busy[slot] = 0;
+  release(&swap.lock);
+}
+
+// Add a reference to slot, for a page-table entry copied by fork.
+void
+swapdup(int slot)
+{
+  __sync_fetch_and_add(&swap.ref[slot], 1);
+}
+
+// Drop a reference to slot.
+void
+swapfree(int slot)
+{
+  if(__sync_fetch_and_sub(&swap.ref[slot], 1) == 0)
+    panic("swapfree");
+}
+
+// Write page to slot, which swapalloc() returned, and free
+// the page.  The page-table entry must already refer to slot.
+void
+swapout(int slot, char *page)
+{
+  ideswaprw(page, slot, 1);
+  kfree(page);
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  swap.npageout++;
+  wakeup(&swap.busy[slot]);
+  release(&swap.lock);
+}
+
+// Read slot into page and drop the caller's reference to it.
+void
+swapin(int slot, char *page)
+{
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  swap.npagein++;
+  release(&swap.lock);
+  ideswaprw(page, slot, 0);
+  swapfree(slot);
+}
+
+// Account for one run of the clock in reclaim().
+void
+swapscanned(uint nscan, int found)
+{
+  acquire(&swap.lock);
+  swap.nreclaim++;
+  swap.nscan += nscan;
+  if(!found)
+    swap.nfail++;
+  release(&swap.lock);
+}
+
+void
+report_swap_stats(void)
+{
+  int i, used;
+
+  if(!ideswappresent()){
+    cprintf("swap: no swap disk\n");
+    return;
+  }
+  used = 0;
+  for(i = 0; i < SWAPPAGES; i++)
+    if(swap.ref[i] || swap.busy[i])
+      used++;
+  cprintf("swap: %d/%d slots used, %d page-outs, %d page-ins\n",
+          used, SWAPPAGES, swap.npageout, swap.npagein);
+  cprintf("swap: %d reclaims, %d PTEs scanned, %d found no victim\n",
+          swap.nreclaim, swap.nscan, swap.nfail);
+}
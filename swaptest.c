@@ -0,0 +1,48 @@
+// Overcommit memory to exercise swapping.  Grows the heap by
+// more megabytes than the machine has (256 by default, or
+// argv[1]), writes a different value into every page, then
+// reads them all back twice, which forces pages out to the
+// swap disk and back in.  Prints the swap statistics.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define MB (1024*1024)
+
+int
+main(int argc, char *argv[])
+{
+  uint i, n, pass, start;
+  int *p;
+
+  n = 256;
+  if(argc > 1)
+    n = atoi(argv[1]);
+  n *= MB;
+
+  // Superpages are never swapped out.
+  set_superpages(0);
+  if((p = (int*)sbrk(n)) == (int*)-1){
+    printf(1, "swaptest: sbrk failed\n");
+    exit();
+  }
+
+  start = uptime();
+  for(i = 0; i < n/4096; i++)
+    p[i*1024] = i;
+  printf(1, "swaptest: wrote %d pages in %d ticks\n", n/4096, uptime() - start);
+  for(pass = 0; pass < 2; pass++){
+    start = uptime();
+    for(i = 0; i < n/4096; i++){
+      if(p[i*1024] != i){
+        printf(1, "swaptest: page %d lost its contents\n", i);
+        exit();
+      }
+    }
+    printf(1, "swaptest: pass %d read back in %d ticks\n", pass, uptime() - start);
+  }
+  report_memory_usage();
+  printf(1, "swaptest OK\n");
+  exit();
+}
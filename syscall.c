@@ -19,11 +19,12 @@ int
 fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
+  uint end;
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  end = uvaend(curproc, addr);
+  if(end == 0 || addr+4 < addr || addr+4 > end)
     return -1;
-  *ip = *(int*)(addr);
-  return 0;
+  return ucopy(ip, (int*)addr, sizeof(*ip));
 }
 
 // Fetch the nul-terminated string at addr from the current process.
@@ -32,15 +33,16 @@ fetchint(uint addr, int *ip)
 int
 fetchstr(uint addr, char **pp)
 {
-  char *s, *ep;
+  char *s, *ep, c;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if((ep = (char*)uvaend(curproc, addr)) == 0)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
-    if(*s == 0)
+    if(ucopy(&c, s, 1) < 0)
+      return -1;
+    if(c == 0)
       return s - *pp;
   }
   return -1;
@@ -60,11 +62,15 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
+  uint end;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  end = uvaend(curproc, i);
+  if(size < 0 || end == 0 || (uint)i+size < (uint)i || (uint)i+size > end)
+    return -1;
+  if(uvaprefault(i, size) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -117,6 +123,19 @@ extern int sys_fibonacci_number(void);
 extern int sys_open_sharedmem(void);
 extern int sys_close_sharedmem(void);
 extern int sys_calculate_factorial(void);
+extern int sys_report_kalloc_stats(void);
+extern int sys_report_memory_usage(void);
+extern int sys_set_superpages(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_report_bcache_stats(void);
+extern int sys_set_readahead(void);
+extern int sys_drop_bcache(void);
+extern int sys_fsync(void);
+extern int sys_report_log_stats(void);
+extern int sys_set_logasync(void);
+extern int sys_set_idedma(void);
+extern int sys_report_disk_stats(void);
 
 static int (*syscalls[])(void) = {
     [SYS_fork] sys_fork,
@@ -153,6 +172,19 @@ static int (*syscalls[])(void) = {
     [SYS_open_sharedmem] sys_open_sharedmem,
     [SYS_close_sharedmem] sys_close_sharedmem,
     [SYS_calculate_factorial] sys_calculate_factorial,
+    [SYS_report_kalloc_stats] sys_report_kalloc_stats,
+    [SYS_report_memory_usage] sys_report_memory_usage,
+    [SYS_set_superpages] sys_set_superpages,
+    [SYS_mmap] sys_mmap,
+    [SYS_munmap] sys_munmap,
+    [SYS_report_bcache_stats] sys_report_bcache_stats,
+    [SYS_set_readahead] sys_set_readahead,
+    [SYS_drop_bcache] sys_drop_bcache,
+    [SYS_fsync] sys_fsync,
+    [SYS_report_log_stats] sys_report_log_stats,
+    [SYS_set_logasync] sys_set_logasync,
+    [SYS_set_idedma] sys_set_idedma,
+    [SYS_report_disk_stats] sys_report_disk_stats,
 };
 
 void
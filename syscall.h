@@ -32,4 +32,17 @@
 #define SYS_fibonacci_number 31
 #define SYS_open_sharedmem 32
 #define SYS_close_sharedmem 33
-#define SYS_calculate_factorial 34
\ No newline at end of file
+#define SYS_calculate_factorial 34
+#define SYS_report_kalloc_stats 35
+#define SYS_report_memory_usage 36
+#define SYS_set_superpages 37
+#define SYS_mmap 38
+#define SYS_munmap 39
+#define SYS_report_bcache_stats 40
+#define SYS_set_readahead 41
+#define SYS_drop_bcache 42
+#define SYS_fsync 43
+#define SYS_report_log_stats 44
+#define SYS_set_logasync 45
+#define SYS_set_idedma 46
+#define SYS_report_disk_stats 47
@@ -73,7 +73,8 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     !uvawritable((uint)p, n))
     return -1;
   return fileread(f, p, n);
 }
@@ -107,11 +108,41 @@ int
 sys_fstat(void)
 {
   struct file *f;
-  struct stat *st;
+  struct stat *st, kst;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0 ||
+     !uvawritable((uint)st, sizeof(*st)))
+    return -1;
+  // st may be copy-on-write, and copying it may run out of memory.
+  if(filestat(f, &kst) < 0 || ucopy(st, &kst, sizeof(kst)) < 0)
     return -1;
-  return filestat(f, st);
+  return 0;
+}
+
+// Return once the writes to fd, and every other finished
+// file system call, are on disk.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  logsync();
+  return 0;
+}
+
+// Turn asynchronous log commits on (1) or off (0): whether
+// an FS system call returns before it is on disk.  Returns
+// whether they were on.
+int
+sys_set_logasync(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  return logsetasync(on);
 }
 
 // Create the path new as a link to the same inode as old.
@@ -422,25 +453,33 @@ sys_exec(void)
 int
 sys_pipe(void)
 {
-  int *fd;
+  int *fd, kfd[2];
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0 ||
+     !uvawritable((uint)fd, 2*sizeof(fd[0])))
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
-  fd0 = -1;
-  if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
-    if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
-    fileclose(rf);
-    fileclose(wf);
-    return -1;
-  }
-  fd[0] = fd0;
-  fd[1] = fd1;
+  fd0 = fd1 = -1;
+  if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0)
+    goto bad;
+  // fd may be copy-on-write, and copying it may run out of memory.
+  kfd[0] = fd0;
+  kfd[1] = fd1;
+  if(ucopy(fd, kfd, sizeof(kfd)) < 0)
+    goto bad;
   return 0;
+
+bad:
+  if(fd0 >= 0)
+    myproc()->ofile[fd0] = 0;
+  if(fd1 >= 0)
+    myproc()->ofile[fd1] = 0;
+  fileclose(rf);
+  fileclose(wf);
+  return -1;
 }
 // Moves a file from its to another directory written by Babak
 int
@@ -572,3 +611,94 @@ bad:
   end_op();
   return -1;
 }
+
+// Map a file, or anonymous memory if fd is -1.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  struct inode *ip;
+  int fd, off, len, prot;
+
+  if(argint(0, &fd) < 0 || argint(1, &off) < 0 || argint(2, &len) < 0 ||
+     argint(3, &prot) < 0 || off < 0 || len <= 0)
+    return -1;
+  if(prot & ~(PROT_READ|PROT_WRITE))
+    return -1;
+  if(fd == -1)
+    return mmap(0, 0, len, prot);
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  // File mappings are read-only; see mmap().
+  if(!f->readable || (prot & PROT_WRITE))
+    return -1;
+  ip = f->ip;
+  ilock(ip);
+  if(ip->type != T_FILE){
+    iunlock(ip);
+    return -1;
+  }
+  iunlock(ip);
+  return mmap(f, off, len, prot);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+int
+sys_report_bcache_stats(void)
+{
+  report_bcache_stats();
+  return 0;
+}
+
+int
+sys_report_log_stats(void)
+{
+  report_log_stats();
+  return 0;
+}
+
+// Turn bus-master DMA on the disk on (1) or off (0).  Returns
+// whether it was on, or -1 if the disk cannot do DMA.
+int
+sys_set_idedma(void)
+{
+  int on;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  return idesetdma(on);
+}
+
+int
+sys_report_disk_stats(void)
+{
+  report_ide_stats();
+  return 0;
+}
+
+// Forget the cached blocks of open file fd, for benchmarks
+// that need to read it from a cold cache.  Only the caller's
+// own file is affected, so other processes keep their cached
+// blocks.
+int
+sys_drop_bcache(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(f->ip->type == T_FILE)
+    idrop(f->ip);
+  iunlock(f->ip);
+  return 0;
+}
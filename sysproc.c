@@ -180,10 +180,10 @@ sys_fibonacci_number(void)
 int
 sys_open_sharedmem(void)
 {
-  int id;
-  if (argint(0, &id) < 0)
+  int id, size;
+  if (argint(0, &id) < 0 || argint(1, &size) < 0)
     return -1;
-  return open_sharedmem(id);
+  return open_sharedmem(id, size);
 }
 
 int sys_close_sharedmem(void)
@@ -202,4 +202,52 @@ int sys_calculate_factorial(void)
     return -1;
   calculate_factorial(n, mem);
   return 0;
-}
\ No newline at end of file
+}
+
+// Print reserved and resident pages of every process
+int
+sys_report_memory_usage(void)
+{
+  return report_memory_usage();
+}
+
+// Print per-CPU page allocator and object cache statistics
+int
+sys_report_kalloc_stats(void)
+{
+  int n;
+
+  n = report_kalloc_stats();
+  report_slab_stats();
+  return n;
+}
+
+// Turn 4MB superpages for this process's heap on or off.
+// Returns the previous setting.
+int
+sys_set_superpages(void)
+{
+  int on, old;
+
+  if(argint(0, &on) < 0)
+    return -1;
+  old = myproc()->superpages;
+  myproc()->superpages = (on != 0);
+  return old;
+}
+
+// Limit file read-ahead for this process to n blocks;
+// 0 turns it off.  Returns the previous limit.
+int
+sys_set_readahead(void)
+{
+  int n, old;
+
+  if(argint(0, &n) < 0 || n < 0)
+    return -1;
+  if(n > RAMAX)
+    n = RAMAX;
+  old = myproc()->readahead;
+  myproc()->readahead = n;
+  return old;
+}
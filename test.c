@@ -178,7 +178,7 @@ void ca5_test(int argc, char *argv[])
     exit();
   }
   int n=atoi(argv[1]),n_children=atoi(argv[2]),pid,mem_id=0;
-  int *shared_mem=(int*)open_sharedmem(mem_id);
+  int *shared_mem=(int*)open_sharedmem(mem_id, 2 * sizeof(int));
   if((int)shared_mem==-1)
   {
     printf(2, "ERROR: open_sharedmem\n");
@@ -12,6 +12,7 @@
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern char ucopymove[], ucopyfault[];  // in ucopy.S
 struct spinlock tickslock;
 uint ticks;
 
@@ -75,8 +76,15 @@ trap(struct trapframe *tf)
     ideintr();
     lapiceoi();
     break;
-  case T_IRQ0 + IRQ_IDE+1:
-    // Bochs generates spurious IDE1 interrupts.
+  case T_TLBFLUSH:
+    tlbintr();
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_IDE2:
+    // Bochs generates spurious IDE1 interrupts when
+    // there is no swap disk.
+    ideswapintr();
+    lapiceoi();
     break;
   case T_IRQ0 + IRQ_KBD:
     kbdintr();
@@ -93,6 +101,20 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Copy-on-write and other user pages resolved on demand.
+    // The kernel itself may fault on user addresses, e.g. in
+    // copyout() or when a system call writes to a user buffer.
+    if(myproc() && pagefault(rcr2(), tf->err) == 0)
+      break;
+    // A user buffer that cannot be mapped makes ucopy() fail.
+    if(myproc() && (tf->cs&3) == 0 && tf->eip == (uint)ucopymove &&
+       rcr2() < KERNBASE){
+      tf->eip = (uint)ucopyfault;
+      break;
+    }
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -2,89 +2,183 @@
 #include "stat.h"
 #include "user.h"
 #include "param.h"
+#include "fcntl.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Size-class memory allocator.
+//
+// Small blocks come in NCLASS power-of-two sizes, from MINBLOCK
+// to MAXSMALL bytes including the header.  Each size has its own
+// free list, so malloc() and free() of a small block take a few
+// instructions instead of a walk over one long list.  A block
+// of a size whose list is empty is cut from the current chunk,
+// CHUNK bytes obtained with one sbrk(); blocks are never split
+// or merged, and free ones only go back to their own list.
+//
+// Bigger blocks are mapped directly with mmap() and unmapped
+// again by free().  If the process is out of mappings they are
+// taken from sbrk() instead and kept on a list of their own,
+// reused first-fit.
 
-typedef long Align;
+#define MINBLOCK   16
+#define NCLASS     8                  // 16 .. 2048 bytes
+#define MAXSMALL   (MINBLOCK << (NCLASS-1))
+#define CHUNK      (64*1024)
+#define PGSIZE     4096
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
-};
+#define BIG_MMAP   NCLASS             // header kinds of big blocks
+#define BIG_SBRK   (NCLASS+1)
 
-typedef union header Header;
+// Header in front of every block; 8 bytes so that blocks stay
+// 8-byte aligned.
+typedef struct header {
+  uint size;            // bytes usable after the header
+  uint kind;            // size class, BIG_MMAP or BIG_SBRK
+} Header;
 
-static Header base;
-static Header *freep;
+// A free block, linked through its first bytes.
+struct run {
+  struct run *next;
+};
 
-void
-free(void *ap)
+static struct run *freelist[NCLASS];
+static struct run *bigfree;
+static char *bump, *bumpend;
+
+static int
+sizeclass(uint nbytes)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  int c;
+  uint n;
+
+  n = nbytes + sizeof(Header);
+  for(c = 0; (MINBLOCK << c) < n; c++)
+    ;
+  return c;
 }
 
-static Header*
-morecore(uint nu)
+// Carve n bytes from the current chunk, getting a new chunk
+// from sbrk() when it runs out.  The new chunk usually follows
+// the old one, whose rest is then used too.
+static char*
+morecore(uint n)
 {
   char *p;
-  Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  if(bump + n > bumpend){
+    if((p = sbrk(CHUNK)) == (char*)-1)
+      return 0;
+    // Start over, aligned, if something else moved the break.
+    if(p != bumpend)
+      bump = (char*)(((uint)p + 7) & ~7);
+    bumpend = p + CHUNK;
+    if(bump + n > bumpend)
+      return 0;
+  }
+  p = bump;
+  bump += n;
+  return p;
+}
+
+static void*
+bigalloc(uint nbytes)
+{
+  Header *h;
+  struct run **pp, *r;
+  uint n;
+
+  n = (nbytes + sizeof(Header) + PGSIZE - 1) & ~(PGSIZE - 1);
+  if(n < nbytes || n >= 0x80000000)
+    return 0;
+  h = (Header*)mmap(-1, 0, n, PROT_READ|PROT_WRITE);
+  if(h != (Header*)-1){
+    h->size = n - sizeof(Header);
+    h->kind = BIG_MMAP;
+    return h + 1;
+  }
+  for(pp = &bigfree; (r = *pp) != 0; pp = &r->next){
+    h = (Header*)r - 1;
+    if(h->size >= nbytes){
+      *pp = r->next;
+      return r;
+    }
+  }
+  if((h = (Header*)sbrk(n)) == (Header*)-1)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  h->size = n - sizeof(Header);
+  h->kind = BIG_SBRK;
+  return h + 1;
+}
+
+void
+free(void *ap)
+{
+  Header *h;
+  struct run *r;
+
+  if(ap == 0)
+    return;
+  h = (Header*)ap - 1;
+  r = (struct run*)ap;
+  if(h->kind == BIG_MMAP){
+    munmap(h, h->size + sizeof(Header));
+  } else if(h->kind == BIG_SBRK){
+    r->next = bigfree;
+    bigfree = r;
+  } else {
+    r->next = freelist[h->kind];
+    freelist[h->kind] = r;
+  }
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  Header *h;
+  struct run *r;
+  int c;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  if(nbytes > MAXSMALL - sizeof(Header))
+    return bigalloc(nbytes);
+  c = sizeclass(nbytes);
+  if((r = freelist[c]) != 0){
+    freelist[c] = r->next;
+    return r;
   }
+  if((h = (Header*)morecore(MINBLOCK << c)) == 0)
+    return 0;
+  h->size = (MINBLOCK << c) - sizeof(Header);
+  h->kind = c;
+  return h + 1;
+}
+
+void*
+calloc(uint n, uint size)
+{
+  void *p;
+
+  if(size && n > 0xffffffff / size)
+    return 0;
+  if((p = malloc(n * size)) != 0)
+    memset(p, 0, n * size);
+  return p;
+}
+
+// Resize the block at ap to nbytes, moving it if it does not
+// fit in place.  realloc(0, n) is malloc(n).
+void*
+realloc(void *ap, uint nbytes)
+{
+  Header *h;
+  void *p;
+
+  if(ap == 0)
+    return malloc(nbytes);
+  h = (Header*)ap - 1;
+  if(nbytes <= h->size)
+    return ap;
+  if((p = malloc(nbytes)) == 0)
+    return 0;
+  memmove(p, ap, h->size);
+  free(ap);
+  return p;
 }
@@ -35,9 +35,22 @@ int set_queue(int,int);
 int report_all_processes(void);
 int report_syscalls_count(void);
 int fibonacci_number(int);
-int open_sharedmem(int);
+int open_sharedmem(int, int);
 int close_sharedmem(int);
 void calculate_factorial(int, int);
+int report_kalloc_stats(void);
+int report_memory_usage(void);
+int set_superpages(int);
+char* mmap(int, int, int, int);
+int munmap(void*, int);
+int report_bcache_stats(void);
+int set_readahead(int);
+int drop_bcache(int);
+int fsync(int);
+int report_log_stats(void);
+int set_logasync(int);
+int set_idedma(int);
+int report_disk_stats(void);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -51,4 +64,6 @@ uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
+void* calloc(uint, uint);
+void* realloc(void*, uint);
 int atoi(const char*);
\ No newline at end of file
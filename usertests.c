@@ -184,6 +184,9 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// Enough 512-byte blocks to need a double-indirect block.
+#define BIGBLOCKS (NDIRECT + 3*NINDIRECT(MINBSIZE))
+
 void
 writetest1(void)
 {
@@ -197,7 +200,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +220,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n == BIGBLOCKS - 1){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -1411,6 +1414,318 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// does a write after fork() stay private to the writer,
+// both for the parent and for the child?
+void
+cowtest(void)
+{
+  int i, pid, fds[2];
+  char *p, c;
+  uint sz = 64*4096;
+
+  printf(stdout, "cow test\n");
+  p = sbrk(sz);
+  if(p == (char*)-1){
+    printf(stdout, "cow test sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < sz; i += 4096)
+    p[i] = 'p';
+  if(pipe(fds) != 0){
+    printf(stdout, "cow test pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "cow test fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    // read() into a copy-on-write page from inside the kernel.
+    close(fds[1]);
+    if(read(fds[0], p + 4096, 1) != 1 || p[4096] != 'x'){
+      printf(stdout, "cow test child read failed\n");
+      exit();
+    }
+    for(i = 2*4096; i < sz; i += 4096){
+      if(p[i] != 'p'){
+        printf(stdout, "cow test child saw wrong data\n");
+        exit();
+      }
+      p[i] = 'c';
+    }
+    exit();
+  }
+  close(fds[0]);
+  for(i = 0; i < sz; i += 4096)
+    p[i] = 'q';
+  write(fds[1], "x", 1);
+  close(fds[1]);
+  wait();
+  for(i = 0; i < sz; i += 4096){
+    c = p[i];
+    if(c != 'q'){
+      printf(stdout, "cow test parent saw child's write\n");
+      exit();
+    }
+  }
+  sbrk(-sz);
+  printf(stdout, "cow test OK\n");
+}
+
+// sbrk() only reserves memory: are untouched pages zero,
+// usable by system calls, and is memory past sbrk(0) still
+// off-limits?
+void
+lazytest(void)
+{
+  int fd, pid;
+  char *p, *end;
+  uint sz = 64*1024*1024;
+
+  printf(stdout, "lazy sbrk test\n");
+  p = sbrk(sz);
+  if(p == (char*)-1){
+    printf(stdout, "lazy sbrk test sbrk failed\n");
+    exit();
+  }
+  end = sbrk(0);
+  if(p[sz/2] != 0 || p[sz-1] != 0){
+    printf(stdout, "lazy sbrk test page not zero\n");
+    exit();
+  }
+  p[sz/2] = 1;
+
+  // the kernel writes into a page nobody has touched yet.
+  fd = open("README", 0);
+  if(fd < 0 || read(fd, p + sz/4, 16) != 16){
+    printf(stdout, "lazy sbrk test read failed\n");
+    exit();
+  }
+  close(fd);
+
+  pid = fork();
+  if(pid == 0){
+    if(p[sz/2] != 1){
+      printf(stdout, "lazy sbrk test fork lost data\n");
+      exit();
+    }
+    end[4096] = 1;
+    printf(stdout, "lazy sbrk test wrote past sbrk(0)\n");
+    exit();
+  }
+  wait();
+
+  sbrk(-sz);
+  printf(stdout, "lazy sbrk test OK\n");
+}
+
+// multi-page shared memory: inherited by fork, visible to
+// both processes, placed above anything sbrk() can reach,
+// and a write through it can be passed to a system call.
+void
+shmtest(void)
+{
+  int fd, pid;
+  char *p, *q;
+  uint sz = 3*4096;
+
+  printf(stdout, "shm test\n");
+  p = (char*)open_sharedmem(77, sz);
+  if(p == (char*)-1){
+    printf(stdout, "shm test open failed\n");
+    exit();
+  }
+  if(p < sbrk(0) || p[0] != 0 || p[sz-1] != 0){
+    printf(stdout, "shm test bad segment\n");
+    exit();
+  }
+  if(sbrk((uint)p - (uint)sbrk(0) + 4096) != (char*)-1){
+    printf(stdout, "shm test sbrk ran into segment\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid == 0){
+    q = (char*)open_sharedmem(77, 0);
+    if(q != p){
+      printf(stdout, "shm test reopen moved segment\n");
+      exit();
+    }
+    fd = open("README", 0);
+    if(fd < 0 || read(fd, p + sz - 16, 16) != 16){
+      printf(stdout, "shm test read failed\n");
+      exit();
+    }
+    close(fd);
+    p[4096] = 'x';
+    close_sharedmem(77);
+    close_sharedmem(77);
+    exit();
+  }
+  wait();
+  if(p[4096] != 'x' || p[sz-16] == 0){
+    printf(stdout, "shm test child write lost\n");
+    exit();
+  }
+  if(close_sharedmem(77) < 0 || close_sharedmem(77) == 0){
+    printf(stdout, "shm test close failed\n");
+    exit();
+  }
+  printf(stdout, "shm test OK\n");
+}
+
+// file-backed and anonymous mmap: pages read from the file
+// on demand, file mappings are read-only, and anonymous
+// pages are zeroed and private.
+void
+mmaptest(void)
+{
+  int fd, i, pid;
+  char *p, *a;
+
+  printf(stdout, "mmap test\n");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  for(i = 0; i < 5000; i++)
+    write(fd, i % 4096 == 0 ? "X" : "a", 1);
+  if(mmap(fd, 0, 5000, PROT_READ|PROT_WRITE) != (char*)-1){
+    printf(stdout, "mmap test writable file mapping allowed\n");
+    exit();
+  }
+  p = mmap(fd, 0, 5000, PROT_READ);
+  if(p == (char*)-1){
+    printf(stdout, "mmap test mmap failed\n");
+    exit();
+  }
+  if(p[0] != 'X' || p[4096] != 'X' || p[4999] != 'a' || p[5000] != 0){
+    printf(stdout, "mmap test wrong contents\n");
+    exit();
+  }
+  if(munmap(p, 5000) < 0){
+    printf(stdout, "mmap test munmap failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("mmapfile", 0);
+  p = mmap(fd, 4096, 4096, PROT_READ);
+  if(p == (char*)-1 || p[0] != 'X' || p[1] != 'a'){
+    printf(stdout, "mmap test offset/permission check failed\n");
+    exit();
+  }
+  // the kernel reads a mapped page nobody has touched yet.
+  if(munmap(p, 4096) < 0 || (p = mmap(fd, 0, 4096, PROT_READ)) == (char*)-1){
+    printf(stdout, "mmap test remap failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("mmapout", O_CREATE|O_RDWR);
+  if(write(fd, p, 2) != 2 || read(fd, p, 1) != -1){
+    printf(stdout, "mmap test write from mapping failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapout");
+  unlink("mmapfile");
+
+  a = mmap(-1, 0, 8192, PROT_READ|PROT_WRITE);
+  if(a == (char*)-1 || a[0] != 0 || a[8191] != 0){
+    printf(stdout, "mmap test anonymous mapping failed\n");
+    exit();
+  }
+  a[0] = 1;
+  pid = fork();
+  if(pid == 0){
+    a[0] = 2;
+    exit();
+  }
+  wait();
+  if(a[0] != 1 || p[0] != 'X'){
+    printf(stdout, "mmap test fork shared private page\n");
+    exit();
+  }
+  munmap(a, 8192);
+  munmap(p, 4096);
+  printf(stdout, "mmap test OK\n");
+}
+
+// program text is shared with other processes running
+// usertests, so neither the process nor the kernel on its
+// behalf may write to it.
+void
+texttest(void)
+{
+  int fd, fds[2], pid;
+  char c;
+
+  printf(stdout, "text test\n");
+  fd = open("README", 0);
+  if(fd < 0 || read(fd, (char*)texttest, 1) != -1){
+    printf(stdout, "text test read into text succeeded\n");
+    exit();
+  }
+  close(fd);
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    *(char*)texttest = 0;
+    write(fds[1], "x", 1);
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 0){
+    printf(stdout, "text test write to text succeeded\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(stdout, "text test OK\n");
+}
+
+// fsync() works on files and directories, and only on them.
+void
+fsynctest(void)
+{
+  int fd, fds[2];
+
+  printf(stdout, "fsync test\n");
+  fd = open("fsyncfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "hello", 5) != 5){
+    printf(stdout, "fsync test create failed\n");
+    exit();
+  }
+  if(fsync(fd) != 0){
+    printf(stdout, "fsync of a file failed\n");
+    exit();
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf(stdout, "fsync of a closed fd succeeded\n");
+    exit();
+  }
+  fd = open(".", 0);
+  if(fd < 0 || fsync(fd) != 0){
+    printf(stdout, "fsync of a directory failed\n");
+    exit();
+  }
+  close(fd);
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  if(fsync(fds[0]) != -1){
+    printf(stdout, "fsync of a pipe succeeded\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("fsyncfile");
+  printf(stdout, "fsync test OK\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1767,6 +2082,12 @@ main(int argc, char *argv[])
   bigwrite();
   bigargtest();
   bsstest();
+  cowtest();
+  lazytest();
+  shmtest();
+  mmaptest();
+  texttest();
+  fsynctest();
   sbrktest();
   validatetest();
 
@@ -7,10 +7,27 @@
 #include "proc.h"
 #include "elf.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "traps.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+#define SUPERPGORDER (PDXSHIFT - PTXSHIFT)  // kalloc_pages() order of a superpage
+
+// Superpage activity, for report_memory_usage().
+static struct {
+  uint nmap;    // 4MB regions mapped with a single PTE_PS entry
+  uint nfail;   // attempts that found no free 4MB block
+  uint nsplit;  // superpages broken up into 4KB pages
+  uint ncopy;   // copy-on-write superpages copied
+} superstats;
+
+static int cowsuperpage(pde_t*);
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -33,6 +50,8 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
+// Returns 0 if va is mapped by a 4MB superpage, which has
+// no PTE; callers that can meet one check for PTE_PS first.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -40,13 +59,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return 0;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -115,33 +135,39 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Set up kernel part of a page table.  The kernel mappings
+// never change after kvmalloc(), so instead of building its
+// own, every page table points at kpgdir's second-level page
+// tables: only the directory entries are copied, and
+// freevm() leaves the kernel half alone.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes.  Its kernel half is shared by
+// all other page tables.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mappages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -178,6 +204,89 @@ switchuvm(struct proc *p)
   popcli();
 }
 
+// TLB shootdown request to the other CPUs running a process
+// with the same page table.  Only one request is in flight at
+// a time; its sender holds busy until every target has
+// cleared its cpu->tlbpending.
+static struct {
+  volatile uint busy;
+  uint va;
+  uint n;
+} tlbreq;
+
+// Invalidate [va, va+n) in this CPU's TLB; reload CR3
+// instead if the range is large.
+static void
+invlpgrange(uint va, uint n)
+{
+  uint a;
+
+  if(n > 32*PGSIZE){
+    lcr3(rcr3());
+    return;
+  }
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+    invlpg(a);
+}
+
+// Handle a TLB shootdown request, from the T_TLBFLUSH
+// interrupt.  tlbflush() also calls it while it spins, so
+// that two CPUs shooting at each other cannot deadlock.
+void
+tlbintr(void)
+{
+  struct cpu *c;
+
+  pushcli();
+  c = mycpu();
+  if(c->tlbpending){
+    invlpgrange(tlbreq.va, tlbreq.n);
+    c->tlbpending = 0;
+  }
+  popcli();
+}
+
+// Invalidate the TLB entries for [va, va+n) of pgdir after
+// changing its mappings, on every CPU that may cache them:
+// this one if pgdir is loaded, and any other running a
+// process with the same page table (a thread), which gets a
+// T_TLBFLUSH IPI.  Must not be called with a spinlock held,
+// since the other CPUs may be spinning on it with interrupts
+// off and never take the IPI.
+void
+tlbflush(pde_t *pgdir, uint va, uint n)
+{
+  struct cpu *c, *me;
+  struct proc *p;
+  int nsent;
+
+  pushcli();
+  me = mycpu();
+  nsent = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    p = c->proc;
+    if(c == me || p == 0 || p->pgdir != pgdir)
+      continue;
+    if(nsent++ == 0){
+      while(xchg(&tlbreq.busy, 1) != 0)
+        tlbintr();
+      tlbreq.va = va;
+      tlbreq.n = n;
+    }
+    c->tlbpending = 1;
+    lapicipi(c->apicid, T_TLBFLUSH);
+  }
+  if(nsent){
+    for(c = cpus; c < cpus+ncpu; c++)
+      while(c->tlbpending)
+        tlbintr();
+    xchg(&tlbreq.busy, 0);
+  }
+  if(rcr3() == V2P(pgdir))
+    invlpgrange(va, n);
+  popcli();
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -193,30 +302,6 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -232,13 +317,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -249,6 +333,64 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Replace the 4MB superpage mapped by *pde with a page table
+// of 1024 ordinary PTEs for the same memory, each page with its
+// own reference count.  Used where 4KB granularity is needed.
+// A superpage still shared with another process after fork()
+// is copied first.
+// The caller must flush the TLB.  Returns -1 if out of memory.
+static int
+splitsuperpage(pde_t *pde)
+{
+  pte_t *pgtab;
+  uint pa, flags, i;
+
+  if((*pde & PTE_COW) && cowsuperpage(pde) < 0)
+    return -1;
+  if((*pde & PTE_PS) == 0)
+    return 0;
+  if((pgtab = (pte_t*)kalloc_zeroed()) == 0)
+    return -1;
+  pa = PTE_ADDR(*pde);
+  flags = PTE_FLAGS(*pde) & ~PTE_PS;
+  ksplit(P2V(pa), SUPERPGORDER);
+  for(i = 0; i < NPTENTRIES; i++)
+    pgtab[i] = (pa + i*PGSIZE) | flags;
+  *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+  superstats.nsplit++;
+  return 0;
+}
+
+static struct execseg* execseg(struct proc*, uint, uint);
+
+// Map a zeroed 4MB superpage for the aligned region around
+// user address va, if the process wants superpages, the whole
+// region lies below p->sz, nothing in it is mapped yet or is
+// still to be loaded from the executable, and a physically
+// contiguous 4MB block is free.
+// Returns -1 if a superpage cannot be used.
+static int
+superpage(struct proc *p, uint va)
+{
+  pde_t *pde;
+  char *mem;
+  uint base;
+
+  base = va & ~(SUPERPGSIZE - 1);
+  pde = &p->pgdir[PDX(base)];
+  if(!p->superpages || *pde != 0 || base + SUPERPGSIZE > p->sz ||
+     base + SUPERPGSIZE > KERNBASE || execseg(p, base, SUPERPGSIZE))
+    return -1;
+  if((mem = kalloc_pages(SUPERPGORDER)) == 0){
+    superstats.nfail++;
+    return -1;
+  }
+  memset(mem, 0, SUPERPGSIZE);
+  *pde = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+  superstats.nmap++;
+  return 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -256,6 +398,7 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  pde_t *pde;
   pte_t *pte;
   uint a, pa;
 
@@ -264,6 +407,22 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    pde = &pgdir[PDX(a)];
+    if(*pde & PTE_PS){
+      if(a % SUPERPGSIZE == 0 && a + SUPERPGSIZE <= oldsz){
+        kfree_pages(P2V(PTE_ADDR(*pde)), SUPERPGORDER);
+        *pde = 0;
+        a += SUPERPGSIZE - PGSIZE;
+        continue;
+      }
+      // Freeing only part of a superpage.  If there is no
+      // memory for a page table, leave the whole superpage
+      // mapped; freevm() will release it.
+      if(splitsuperpage(pde) < 0){
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+        continue;
+      }
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -274,13 +433,16 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       char *v = P2V(pa);
       kfree(v);
       *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_ADDR(*pte) >> PTXSHIFT);
+      *pte = 0;
     }
   }
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part belongs to kpgdir.
 void
 freevm(pde_t *pgdir)
 {
@@ -289,7 +451,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -311,37 +473,521 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Copy the mappings of [start, end) from pgdir to d the
+// way copyuvm() below does.  On failure, the pages already
+// mapped in d are left for freevm() to release.
+static int
+copyrange(pde_t *pgdir, pde_t *d, uint start, uint end)
+{
+  pte_t *pte, *dpte;
+  uint pa, i, flags;
+
+  for(i = start; i < end; i += PGSIZE){
+    // A superpage is shared whole, copy-on-write at the
+    // page directory entry, with one reference on its block.
+    if(pgdir[PDX(i)] & PTE_PS){
+      if(pgdir[PDX(i)] & PTE_W)
+        pgdir[PDX(i)] = (pgdir[PDX(i)] & ~PTE_W) | PTE_COW;
+      d[PDX(i)] = pgdir[PDX(i)];
+      kref(P2V(PTE_ADDR(pgdir[PDX(i)])));
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      // Each side reads its own copy back from the slot.
+      if((dpte = walkpgdir(d, (char*)i, 1)) == 0)
+        return -1;
+      *dpte = *pte;
+      swapdup(PTE_ADDR(*pte) >> PTXSHIFT);
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if((*pte & (PTE_W|PTE_SHARED)) == PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    pa = PTE_ADDR(*pte);
+    flags = PTE_FLAGS(*pte);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+      return -1;
+    kref(P2V(pa));
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  Pages that were never touched stay
+// unmapped, and superpages stay superpages.  Pages are not
+// copied: both page tables map the same physical page, and
+// writable pages become read-only PTE_COW pages in both, to
+// be copied by cowpage() or cowsuperpage() when either side
+// writes to them.  Shared memory pages stay writable in
+// both.
+// The caller must flush the parent's TLB.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
+  if(copyrange(pgdir, d, 0, sz) < 0){
+    freevm(d);
+    return 0;
+  }
+  return d;
+}
+
+// Page fault handlers return FAULT_NOMEM when they could not
+// allocate a page; pagefault() then reclaims memory and retries.
+#define FAULT_NOMEM (-2)
+
+// Give pgdir a private, writable copy of the copy-on-write
+// page mapped by pte at va.  If no other page table refers
+// to the page any more, it is simply made writable.
+// Returns FAULT_NOMEM if out of memory.
+static int
+cowpage(pde_t *pgdir, pte_t *pte, uint va)
+{
+  char *mem, *old;
+
+  old = P2V(PTE_ADDR(*pte));
+  if(krefcount(old) > 1){
     if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
+      return FAULT_NOMEM;
+    memmove(mem, old, PGSIZE);
+    *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+    kfree(old);
+  } else
+    *pte = (*pte & ~PTE_COW) | PTE_W;
+  tlbflush(pgdir, PGROUNDDOWN(va), PGSIZE);
+  return 0;
+}
+
+// Give *pde a private, writable copy of its copy-on-write
+// superpage: another 4MB block if one is free, or else 4KB
+// pages under a new page table.  If no other page table
+// refers to the block any more, it is simply made writable.
+// The caller must flush the TLB.
+// Returns FAULT_NOMEM if out of memory.
+static int
+cowsuperpage(pde_t *pde)
+{
+  char *mem, *old;
+  pte_t *pgtab;
+  uint flags, i;
+
+  old = P2V(PTE_ADDR(*pde));
+  flags = (PTE_FLAGS(*pde) & ~PTE_COW) | PTE_W;
+  if(krefcount(old) == 1){
+    *pde = PTE_ADDR(*pde) | flags;
+    return 0;
+  }
+  if((mem = kalloc_pages(SUPERPGORDER)) != 0){
+    memmove(mem, old, SUPERPGSIZE);
+    *pde = V2P(mem) | flags;
+  } else {
+    if((pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return FAULT_NOMEM;
+    for(i = 0; i < NPTENTRIES; i++){
+      if((mem = kalloc()) == 0){
+        while(i-- > 0)
+          kfree(P2V(PTE_ADDR(pgtab[i])));
+        kfree((char*)pgtab);
+        return FAULT_NOMEM;
+      }
+      memmove(mem, old + i*PGSIZE, PGSIZE);
+      pgtab[i] = V2P(mem) | (flags & ~PTE_PS);
+    }
+    *pde = V2P(pgtab) | PTE_P | PTE_W | PTE_U;
+    superstats.nsplit++;
+  }
+  kfree_pages(old, SUPERPGORDER);
+  superstats.ncopy++;
+  return 0;
+}
+
+// Map a zeroed page at user address va, which lies below
+// the process size but has never been touched.
+// Returns FAULT_NOMEM if out of memory.
+static int
+zeropage(pde_t *pgdir, uint va)
+{
+  char *mem;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return FAULT_NOMEM;
+  if(mappages(pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return FAULT_NOMEM;
+  }
+  return 0;
+}
+
+// Return the segment of p's executable whose file-backed part
+// overlaps [va, va+n), or 0.
+static struct execseg*
+execseg(struct proc *p, uint va, uint n)
+{
+  struct execseg *s;
+
+  if(p->exe == 0)
+    return 0;
+  for(s = p->segs; s < &p->segs[NEXECSEG]; s++)
+    if(s->filesz && va < s->va + s->filesz && va + n > s->va)
+      return s;
+  return 0;
+}
+
+// Pages of read-only program segments, shared by all the
+// processes running the same executable.  An entry holds a
+// reference to its page and lives as long as some process is
+// running the file: textref() and textunref() count those
+// processes in the inode, and the last textunref() drops the
+// file's pages from the cache.  The pages themselves are freed
+// when the last page table that maps them goes away.  writei()
+// drops the file's pages when it changes the file, so that
+// later faults read the new contents; pages a process has
+// already mapped stay as they were.  Each inode lists its own
+// pages, so a lookup only looks at the pages of one program.
+struct textpage {
+  uint va;
+  char *mem;
+  struct textpage *next;   // next page of the inode, or next free
+};
+
+static struct {
+  struct spinlock lock;
+  struct textpage page[NTEXTPAGES];
+  struct textpage *free;
+  int npage;
+  uint nhit;
+  uint nmiss;
+} text;
+
+void
+textinit(void)
+{
+  struct textpage *t;
+
+  initlock(&text.lock, "text");
+  for(t = text.page; t < &text.page[NTEXTPAGES]; t++){
+    t->next = text.free;
+    text.free = t;
+  }
+}
+
+// A process has started running ip.
+void
+textref(struct inode *ip)
+{
+  acquire(&text.lock);
+  ip->ntext++;
+  release(&text.lock);
+}
+
+// Drop the cache's references to the pages of ip.
+// Caller holds text.lock.
+static void
+textfree(struct inode *ip)
+{
+  struct textpage *t, *next;
+
+  for(t = ip->text; t; t = next){
+    next = t->next;
+    kfree(t->mem);
+    t->next = text.free;
+    text.free = t;
+    text.npage--;
+  }
+  ip->text = 0;
+}
+
+// A process has stopped running ip.
+void
+textunref(struct inode *ip)
+{
+  acquire(&text.lock);
+  if(--ip->ntext > 0){
+    release(&text.lock);
+    return;
+  }
+  textfree(ip);
+  release(&text.lock);
+}
+
+// The contents of ip are about to change: forget its cached
+// pages.  Called by writei() with ip locked, which keeps
+// execpage() from adding a page read before the change.
+void
+textdrop(struct inode *ip)
+{
+  acquire(&text.lock);
+  textfree(ip);
+  release(&text.lock);
+}
+
+// Return the cached page at va of ip with a reference for
+// the caller, or 0.
+static char*
+textget(struct inode *ip, uint va)
+{
+  struct textpage *t;
+  char *mem;
+
+  acquire(&text.lock);
+  for(t = ip->text; t; t = t->next){
+    if(t->va == va){
+      mem = t->mem;
+      kref(mem);
+      text.nhit++;
+      release(&text.lock);
+      return mem;
+    }
+  }
+  text.nmiss++;
+  release(&text.lock);
+  return 0;
+}
+
+// Enter mem, just read as the page at va of ip, in the cache
+// and return the page the caller should map.  If another
+// process loaded the same page meanwhile, mem is freed and
+// that page is returned instead.  With the cache full, mem
+// simply stays private.
+static char*
+textadd(struct inode *ip, uint va, char *mem)
+{
+  struct textpage *t;
+  char *old;
+
+  acquire(&text.lock);
+  for(t = ip->text; t; t = t->next){
+    if(t->va == va){
+      old = t->mem;
+      kref(old);
+      release(&text.lock);
       kfree(mem);
-      goto bad;
+      return old;
     }
   }
-  return d;
+  if((t = text.free) != 0){
+    text.free = t->next;
+    t->va = va;
+    t->mem = mem;
+    t->next = ip->text;
+    ip->text = t;
+    text.npage++;
+    kref(mem);
+  }
+  release(&text.lock);
+  return mem;
+}
+
+void
+report_text_stats(void)
+{
+  cprintf("text: %d/%d shared pages cached, %d hits, %d misses\n",
+          text.npage, NTEXTPAGES, text.nhit, text.nmiss);
+}
 
-bad:
-  freevm(d);
+// Load the page at va of program segment s from the
+// executable, the first time the process touches it.
+// Bytes past the end of the file-backed part are zero.
+// Pages of read-only segments come from the text cache and
+// are mapped read-only; writable ones are private.
+static int
+execpage(struct proc *p, struct execseg *s, uint va)
+{
+  char *mem;
+  uint n;
+  int perm;
+
+  va = PGROUNDDOWN(va);
+  perm = s->writable ? PTE_W|PTE_U : PTE_U|PTE_SHARED;
+  if(s->writable || (mem = textget(p->exe, va)) == 0){
+    if((mem = kalloc_zeroed()) == 0)
+      return FAULT_NOMEM;
+    n = s->va + s->filesz - va;
+    if(n > PGSIZE)
+      n = PGSIZE;
+    // System calls fault their buffers in before locking an
+    // inode (uvaprefault()), so this cannot be held already.
+    ilock(p->exe);
+    if(readi(p->exe, mem, s->off + va - s->va, n) != n){
+      iunlock(p->exe);
+      kfree(mem);
+      return -1;
+    }
+    if(!s->writable)
+      mem = textadd(p->exe, va, mem);
+    iunlock(p->exe);
+  }
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return FAULT_NOMEM;
+  }
+  return 0;
+}
+
+// Read the swapped-out page of pte back from the swap disk.
+// Returns FAULT_NOMEM if out of memory.
+static int
+swappage(pte_t *pte)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return FAULT_NOMEM;
+  swapin(PTE_ADDR(*pte) >> PTXSHIFT, mem);
+  *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_P;
+  return 0;
+}
+
+static int vmafault(struct proc*, uint, uint);
+static int fault(uint, uint);
+
+// Handle a page fault on user address va in the current
+// process; err is the error code pushed by the processor.
+// Returns 0 if the faulting instruction can be restarted,
+// -1 if the access was invalid.
+int
+pagefault(uint va, uint err)
+{
+  int r;
+
+  while((r = fault(va, err)) == FAULT_NOMEM)
+    if(reclaim() < 0)
+      return -1;
+  return r;
+}
+
+// Do the work of pagefault().
+static int
+fault(uint va, uint err)
+{
+  struct proc *curproc = myproc();
+  struct execseg *s;
+  pde_t *pde;
+  pte_t *pte;
+  int r;
+
+  if(va >= KERNBASE)
+    return -1;
+  if(va >= curproc->sz)
+    return vmafault(curproc, va, err);
+  pde = &curproc->pgdir[PDX(va)];
+  if(*pde & PTE_PS){
+    if(!(err & FEC_WR) || !(*pde & PTE_COW))
+      return -1;
+    if((r = cowsuperpage(pde)) == 0)
+      tlbflush(curproc->pgdir, va & ~(SUPERPGSIZE-1), SUPERPGSIZE);
+    return r;
+  }
+  pte = walkpgdir(curproc->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_SWAP))
+    return swappage(pte);
+  if(pte == 0 || (*pte & PTE_P) == 0){
+    if((s = execseg(curproc, PGROUNDDOWN(va), PGSIZE)) != 0)
+      return execpage(curproc, s, va);
+    if(pte == 0 && superpage(curproc, va) == 0)
+      return 0;
+    return zeropage(curproc->pgdir, va);
+  }
+  if((err & FEC_WR) && (*pte & (PTE_P|PTE_U|PTE_COW)) == (PTE_P|PTE_U|PTE_COW))
+    return cowpage(curproc->pgdir, pte, va);
+  return -1;
+}
+
+// Count the 4MB superpages in the user part of pgdir.
+int
+superpages(pde_t *pgdir)
+{
+  int i, n;
+
+  n = 0;
+  for(i = 0; i < PDX(KERNBASE); i++)
+    if(pgdir[i] & PTE_PS)
+      n++;
+  return n;
+}
+
+// Print system-wide superpage counters.
+void
+report_superpage_stats(void)
+{
+  cprintf("superpages: %d mapped, %d split, %d fell back to 4KB pages, "
+          "%d copied on write\n", superstats.nmap, superstats.nsplit,
+          superstats.nfail, superstats.ncopy);
+}
+
+// Count the user pages below sz that are backed by
+// physical memory in pgdir.
+int
+residentpages(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = 0; a < sz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      n += NPTENTRIES;
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if(*pte & PTE_P)
+      n++;
+  }
+  return n;
+}
+
+// One step of the clock for reclaim(): scan the user pages
+// of pgdir from *va up to sz for a page to swap out.  Pages
+// whose accessed bit is set get a second chance: the bit is
+// cleared and the scan moves on.  Shared pages and superpages
+// are never swapped.  The first page that has not been used
+// since the last pass is unmapped, its PTE pointing to swap
+// slot instead; *page is set to the page and *va to the next
+// address to scan, and 1 is returned.  At sz, returns 0.
+// Caller holds ptable.lock and the process is not running
+// elsewhere, so no other TLB can hold the PTE.
+int
+clockscan(pde_t *pgdir, uint sz, uint *va, int slot, char **page, uint *nscan)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = *va; a < sz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U|PTE_SHARED)) != (PTE_P|PTE_U))
+      continue;
+    (*nscan)++;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    if(krefcount(P2V(PTE_ADDR(*pte))) != 1)
+      continue;
+    *page = P2V(PTE_ADDR(*pte));
+    *pte = (slot << PTXSHIFT) | (PTE_FLAGS(*pte) & (PTE_W|PTE_U|PTE_COW)) | PTE_SWAP;
+    *va = a + PGSIZE;
+    return 1;
+  }
   return 0;
 }
 
@@ -352,8 +998,10 @@ uva2ka(pde_t *pgdir, char *uva)
 {
   pte_t *pte;
 
+  if(pgdir[PDX(uva)] & PTE_PS)
+    return (char*)P2V(PTE_ADDR(pgdir[PDX(uva)])) + ((uint)uva & (SUPERPGSIZE-1));
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -363,15 +1011,32 @@ uva2ka(pde_t *pgdir, char *uva)
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// Untouched pages of the current process are mapped first.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    if((pgdir[PDX(va0)] & (PTE_PS|PTE_COW)) == (PTE_PS|PTE_COW)){
+      if(cowsuperpage(&pgdir[PDX(va0)]) < 0)
+        return -1;
+      tlbflush(pgdir, va0 & ~(SUPERPGSIZE-1), SUPERPGSIZE);
+    }
+    if((pgdir[PDX(va0)] & PTE_PS) == 0){
+      pte = walkpgdir(pgdir, (char*)va0, 0);
+      if((pte == 0 || (*pte & PTE_P) == 0) && pgdir == myproc()->pgdir &&
+         pagefault(va0, FEC_WR) < 0)
+        return -1;
+      pte = walkpgdir(pgdir, (char*)va0, 0);
+      if(pte && (*pte & (PTE_P|PTE_U|PTE_COW)) == (PTE_P|PTE_U|PTE_COW) &&
+         cowpage(pgdir, pte, va0) < 0)
+        return -1;
+    }
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -393,120 +1058,459 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 //PAGEBREAK!
 // Blank page.
 
+#define SHMNPTR (PGSIZE / sizeof(char*))  // page pointers per index page
+
+// A named shared memory segment.  Segments are created by the
+// first open_sharedmem() of an id and freed when the last
+// process that has them mapped closes them or exits.  Their
+// pages come from kalloc() one at a time and are found through
+// a two-level index, like a page table: dir holds index pages,
+// each of which holds SHMNPTR page pointers.
+struct shmseg {
+  int id;
+  uint npages;           // size in pages
+  char ***dir;           // index pages; unused entries are 0
+  int ref;               // processes with the segment mapped
+  struct shmseg *next;
+};
+
 static struct
 {
   struct spinlock lock;
-  int id[_NSHAREDPAGES];
-  char* pa[_NSHAREDPAGES];
-  int ref_count[_NSHAREDPAGES];
-  int va[NPROC][_NSHAREDPAGES];
+  struct kmem_cache *cache;
+  struct shmseg *list;
 } shm_table;
 
 void _shared_mem_init(void)
 {
   initlock(&shm_table.lock, "shared memory table");
-  for (int i = 0; i < _NSHAREDPAGES; i++)
-  {
-    shm_table.pa[i] = kalloc();
-    if (shm_table.pa[i] == 0)
-      panic("_shared_mem_init: kalloc failed");
-    shm_table.ref_count[i]=0;
+  shm_table.cache = kmem_cache_create("shm", sizeof(struct shmseg));
+}
+
+// Return page i of segment s.
+static char*
+shmpage(struct shmseg *s, uint i)
+{
+  return s->dir[i / SHMNPTR][i % SHMNPTR];
+}
+
+// Free the pages of segment s, as far as they were allocated,
+// and its index.
+static void
+shmfree(struct shmseg *s)
+{
+  uint i;
+
+  for(i = 0; i < s->npages && s->dir[i / SHMNPTR] && shmpage(s, i); i++)
+    kfree(shmpage(s, i));
+  for(i = 0; i < SHMNPTR && s->dir[i]; i++)
+    kfree((char*)s->dir[i]);
+  kfree((char*)s->dir);
+}
+
+// Find or create the segment for id, taking a reference.
+// A new segment is size bytes long (one page if size is 0).
+// Caller holds shm_table.lock.
+static struct shmseg*
+shmget(int id, uint size)
+{
+  struct shmseg *s;
+  uint i;
+
+  for(s = shm_table.list; s; s = s->next){
+    if(s->id == id){
+      if(size > s->npages * PGSIZE)
+        return 0;
+      s->ref++;
+      return s;
+    }
   }
+
+  if(size >= KERNBASE || (s = kmem_cache_alloc(shm_table.cache)) == 0)
+    return 0;
+  s->id = id;
+  s->npages = size ? PGROUNDUP(size) / PGSIZE : 1;
+  if((s->dir = (char***)kalloc_zeroed()) == 0){
+    kmem_cache_free(shm_table.cache, s);
+    return 0;
+  }
+  for(i = 0; i < s->npages; i++){
+    if((i % SHMNPTR == 0 &&
+        (s->dir[i / SHMNPTR] = (char**)kalloc_zeroed()) == 0) ||
+       (s->dir[i / SHMNPTR][i % SHMNPTR] = kalloc_zeroed()) == 0){
+      shmfree(s);
+      kmem_cache_free(shm_table.cache, s);
+      return 0;
+    }
+  }
+  s->ref = 1;
+  s->next = shm_table.list;
+  shm_table.list = s;
+  return s;
 }
 
-int open_sharedmem(int id)
+// Drop a reference to segment s, freeing it with the last one.
+static void
+shmput(struct shmseg *s)
 {
-  int mem_idx = -1;
-  struct proc *curproc = myproc();
-  uint va = PGROUNDUP(curproc->sz);
-  pde_t *pgdir = curproc->pgdir;
+  struct shmseg **pp;
+
   acquire(&shm_table.lock);
-  for (int i = 0; i < _NSHAREDPAGES; i++)
-  {
-    if(shm_table.ref_count[i]==0)
-      mem_idx = i;
-    else if (shm_table.id[i]==id)
-    {
-      mem_idx = i;
-      break;
+  if(--s->ref > 0){
+    release(&shm_table.lock);
+    return;
+  }
+  for(pp = &shm_table.list; *pp != s; pp = &(*pp)->next)
+    ;
+  *pp = s->next;
+  release(&shm_table.lock);
+
+  shmfree(s);
+  kmem_cache_free(shm_table.cache, s);
+}
+
+// Map all pages of segment s at va in pgdir, each PTE holding
+// a reference to its page.
+static int
+mapshm(pde_t *pgdir, uint va, struct shmseg *s)
+{
+  uint i;
+
+  for(i = 0; i < s->npages; i++){
+    if(mappages(pgdir, (char*)va + i*PGSIZE, PGSIZE, V2P(shmpage(s, i)),
+                PTE_W | PTE_U | PTE_SHARED) < 0){
+      deallocuvm(pgdir, va + i*PGSIZE, va);
+      return -1;
     }
+    kref(shmpage(s, i));
   }
-  if (mem_idx==-1)
-  {
-    release(&shm_table.lock);
+  return 0;
+}
+
+// Mappings live at the top of the user address space, just
+// below KERNBASE, and grow down towards the heap.  Return the
+// lowest mapped address, which is as far as sbrk() may grow.
+uint
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint base;
+
+  base = KERNBASE;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// Find the highest free range of n bytes between the heap
+// and KERNBASE.  Returns 0 if there is none.
+static uint
+vmaplace(struct proc *p, uint n)
+{
+  struct vma *v;
+  uint top;
+
+  top = KERNBASE;
+again:
+  if(n > top || top - n < PGROUNDUP(p->sz))
+    return 0;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++){
+    if(v->end && v->start < top && v->end > top - n){
+      top = v->start;
+      goto again;
+    }
+  }
+  return top - n;
+}
+
+// If user address va lies in the heap or in a mapping of p,
+// return the end of that region; otherwise return 0.
+// Used to check system call arguments.
+uint
+uvaend(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  if(va < p->sz)
+    return p->sz;
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end && va >= v->start && va < v->end)
+      return v->end;
+  return 0;
+}
+
+// Unmap v from p's page table, dropping its segment or file.
+// The caller must flush the TLB.
+static void
+vmafree(struct proc *p, struct vma *v)
+{
+  deallocuvm(p->pgdir, v->end, v->start);
+  if(v->shm)
+    shmput(v->shm);
+  if(v->f)
+    fileclose(v->f);
+  memset(v, 0, sizeof(*v));
+}
+
+// Remove all of p's mappings.  Called by exit() and exec().
+void
+freevmas(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end)
+      vmafree(p, v);
+}
+
+// Give child np the same mappings as p, at the same
+// addresses.  Shared memory stays shared with the child;
+// anonymous pages become copy-on-write.
+int
+copyvmas(struct proc *np, struct proc *p)
+{
+  struct vma *v, *nv;
+
+  for(v = p->vmas, nv = np->vmas; v < &p->vmas[NVMA]; v++, nv++){
+    if(v->end == 0)
+      continue;
+    if(copyrange(p->pgdir, np->pgdir, v->start, v->end) < 0){
+      freevmas(np);
+      return -1;
+    }
+    if(v->shm){
+      acquire(&shm_table.lock);
+      v->shm->ref++;
+      release(&shm_table.lock);
+    }
+    if(v->f)
+      filedup(v->f);
+    *nv = *v;
+  }
+  return 0;
+}
+
+// Return the mapping of p that contains va, or 0.
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vmas; v < &p->vmas[NVMA]; v++)
+    if(v->end && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Handle a page fault at va above the heap of p: fill in a
+// page of an mmap()ed file or anonymous mapping on first
+// touch, or break copy-on-write.  Reading the file sleeps, so
+// the faulting code must not hold a spinlock; see
+// uvaprefault().
+static int
+vmafault(struct proc *p, uint va, uint err)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if((v = findvma(p, va)) == 0)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walkpgdir(p->pgdir, (char*)va, 0);
+  if(pte && (*pte & PTE_P)){
+    if((err & FEC_WR) && (*pte & PTE_COW))
+      return cowpage(p->pgdir, pte, va);
     return -1;
   }
-  shm_table.id[mem_idx]=id;
-  shm_table.ref_count[mem_idx]++;
-  release(&shm_table.lock);
-  if (mappages(pgdir, (char *)va, PGSIZE, V2P(shm_table.pa[mem_idx]), PTE_W | PTE_U) < 0)
-  {
-    acquire(&shm_table.lock);
-    shm_table.ref_count[mem_idx]--;
-    release(&shm_table.lock);
+  if((err & FEC_WR) && !(v->prot & PROT_WRITE))
     return -1;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return FAULT_NOMEM;
+  perm = PTE_U;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->f)
+    filereadat(v->f, mem, v->off + va - v->start, PGSIZE);
+  if(mappages(p->pgdir, (char*)va, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return FAULT_NOMEM;
   }
-  switchuvm(curproc);
-  shm_table.va[curproc->pid][mem_idx] = va;
-  curproc->sz += PGSIZE;
-  return (int)va;
+  return 0;
 }
 
-// Remove PTEs for virtual addresses starting at va that refer to
-// physical addresses starting at pa. va and size might not
-// be page-aligned.
-static int
-unmappages(pde_t *pgdir, void *va, uint size)
+// Fault in the missing pages of [va, va+n) of the current
+// process.  System calls do this for their buffers before
+// using them, because the kernel may touch a buffer while
+// holding a lock that loading the page needs: a spinlock
+// (pipewrite), where vmafault() cannot sleep to read the file,
+// or the lock of the very inode the page comes from, as in a
+// read() of the running executable into its own unloaded data,
+// where execpage() would deadlock.  Once loaded, a page goes
+// to swap, never back to its file.
+int
+uvaprefault(uint va, uint n)
 {
-  char *a, *last;
+  struct proc *curproc = myproc();
   pte_t *pte;
+  uint a;
 
-  a = (char *)PGROUNDDOWN((uint)va);
-  last = (char *)PGROUNDDOWN(((uint)va) + size - 1);
-  for (;;)
-  {
-    if ((pte = walkpgdir(pgdir, a, 1)) == 0)
+  if(n == 0)
+    return 0;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    if(curproc->pgdir[PDX(a)] & PTE_PS)
+      continue;
+    pte = walkpgdir(curproc->pgdir, (char*)a, 0);
+    if((pte == 0 || (*pte & PTE_P) == 0) && pagefault(a, 0) < 0)
       return -1;
-    if (!*pte || !PTE_P)
-      panic("reunmap");
-    *pte = 0;
-    if (a == last)
-      break;
-    a += PGSIZE;
   }
   return 0;
 }
 
-int close_sharedmem(int id)
+// Can the kernel write to the n bytes at user address va?
+// False for read-only mappings and program text, which the
+// kernel must not write to because CR0_WP makes that a fault.
+int
+uvawritable(uint va, uint n)
 {
-  int mem_idx = -1;
   struct proc *curproc = myproc();
-  pde_t *pgdir = curproc->pgdir;
-  acquire(&shm_table.lock);
-  for (int i = 0; i < _NSHAREDPAGES; i++)
+  struct execseg *s;
+  struct vma *v;
+
+  if(va < curproc->sz){
+    if(curproc->exe == 0)
+      return 1;
+    for(s = curproc->segs; s < &curproc->segs[NEXECSEG]; s++)
+      if(s->filesz && !s->writable &&
+         va < PGROUNDUP(s->va + s->filesz) && va + n > s->va)
+        return 0;
+    return 1;
+  }
+  v = findvma(myproc(), va);
+  return v && (v->prot & PROT_WRITE) && va + n <= v->end;
+}
+
+// Map len bytes of file f starting at offset off, or
+// anonymous zeroed memory if f is 0, into the current
+// process and return the address.  Pages are filled in on
+// first touch.  A file page is a copy of the file's contents
+// at that time and is not updated by later write()s.  File
+// mappings are read-only: with no page cache shared with
+// read() and write(), stores through a mapping could not be
+// kept coherent with the file.
+int
+mmap(struct file *f, uint off, uint len, int prot)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  uint va;
+
+  if(len == 0 || off % PGSIZE || (f && (prot & PROT_WRITE)))
+    return -1;
+  len = PGROUNDUP(len);
+  for(v = curproc->vmas; v < &curproc->vmas[NVMA]; v++)
+    if(v->end == 0)
+      break;
+  if(v == &curproc->vmas[NVMA] || len == 0 ||
+     (va = vmaplace(curproc, len)) == 0)
+    return -1;
+  v->start = va;
+  v->end = va + len;
+  v->prot = prot;
+  v->off = off;
+  if(f)
+    v->f = filedup(f);
+  return (int)va;
+}
+
+// Remove the mmap() at addr, which must be len bytes long.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  if((v = findvma(curproc, addr)) == 0 || v->shm ||
+     v->start != addr || v->end - v->start != PGROUNDUP(len))
+    return -1;
+  len = v->end - v->start;
+  vmafree(curproc, v);
+  tlbflush(curproc->pgdir, addr, len);
+  return 0;
+}
+
+// Map shared memory segment id into the current process and
+// return its address.  The segment is created size bytes long
+// if it does not exist yet; otherwise size must not be larger
+// than the segment (0 always fits).  Opening a segment that is
+// already mapped, for example one inherited across fork(),
+// returns the existing mapping.
+int open_sharedmem(int id, int size)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, *fv;
+  struct shmseg *s;
+  uint va;
+
+  if (size < 0)
+    return -1;
+  fv = 0;
+  for (v = curproc->vmas; v < &curproc->vmas[NVMA]; v++)
   {
-    if (shm_table.id[i] == id && shm_table.ref_count[i])
+    if (v->shm && v->shm->id == id)
     {
-      mem_idx = i;
-      break;
+      if (size > v->end - v->start)
+        return -1;
+      v->nopen++;
+      return (int)v->start;
     }
+    if (v->end == 0 && fv == 0)
+      fv = v;
   }
-  if (mem_idx == -1)
-  {
-    release(&shm_table.lock);
+  if (fv == 0)
     return -1;
-  }
-  shm_table.ref_count[mem_idx]--;
+
+  acquire(&shm_table.lock);
+  s = shmget(id, size);
   release(&shm_table.lock);
-  uint va = shm_table.va[curproc->pid][mem_idx];
-  if (unmappages(pgdir, (char *)va, PGSIZE) < 0)
+  if (s == 0)
+    return -1;
+  if ((va = vmaplace(curproc, s->npages * PGSIZE)) == 0 ||
+      mapshm(curproc->pgdir, va, s) < 0)
   {
-    acquire(&shm_table.lock);
-    shm_table.ref_count[mem_idx]++;
-    release(&shm_table.lock);
+    shmput(s);
     return -1;
   }
-  switchuvm(curproc);
-  curproc->sz -= PGSIZE;
-  return 0;
-}
\ No newline at end of file
+  fv->start = va;
+  fv->end = va + s->npages * PGSIZE;
+  fv->prot = PROT_READ | PROT_WRITE;
+  fv->nopen = 1;
+  fv->shm = s;
+  return (int)va;
+}
+
+// Undo one open_sharedmem(id) by the current process,
+// unmapping the segment when it was the last one.
+int close_sharedmem(int id)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  for (v = curproc->vmas; v < &curproc->vmas[NVMA]; v++)
+  {
+    if (v->shm && v->shm->id == id)
+    {
+      if (--v->nopen == 0)
+      {
+        uint start = v->start, len = v->end - v->start;
+        vmafree(curproc, v);
+        tlbflush(curproc->pgdir, start, len);
+      }
+      return 0;
+    }
+  }
+  return -1;
+}